@@ -0,0 +1,129 @@
+#include "cpu_dispatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./math/vec3.h"
+#include "./rendering/rasterizer.h"
+#include "state.h"
+
+cpu_level_t cpu_level = CPU_SCALAR;
+
+static const char *cpu_level_names[] = {
+    [CPU_SCALAR] = "scalar", [CPU_SSE41] = "sse41", [CPU_AVX2] = "avx2",
+    [CPU_AVX512] = "avx512", [CPU_NEON] = "neon",
+};
+
+const char *cpu_level_name(cpu_level_t level) {
+    return cpu_level_names[level];
+}
+
+static cpu_level_t detect_cpu_level(void) {
+#ifdef __ARM_NEON__
+    // always there on arm64
+    return CPU_NEON;
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return CPU_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return CPU_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return CPU_SSE41;
+    return CPU_SCALAR;
+#else
+    return CPU_SCALAR;
+#endif
+}
+
+static bool level_supported(cpu_level_t level, cpu_level_t detected) {
+    if (level == CPU_SCALAR) return true;
+    if (detected == CPU_NEON || level == CPU_NEON) return level == detected;
+    return level <= detected;
+}
+
+static void bind_kernels(cpu_level_t level) {
+    fill_triangle = fill_triangle_scalar;
+    block_max_z = block_max_z_scalar;
+    clear_framebuffer = clear_framebuffer_scalar;
+    clear_zbuffer = clear_zbuffer_scalar;
+    vec3_norm = vec3_norm_scalar;
+    matrix_transformation = matrix_transformation_scalar;
+    transform_points = transform_points_scalar;
+
+    switch (level) {
+    case CPU_SCALAR:
+        break;
+
+#if defined(__x86_64__) || defined(__i386__)
+    case CPU_AVX512:
+        fill_triangle = fill_triangle_avx512;
+        clear_framebuffer = clear_framebuffer_avx512;
+        clear_zbuffer = clear_zbuffer_avx512;
+        // the hi-z blocks are only 8 wide and the 4 wide math kernels gain
+        // nothing from wider registers
+        block_max_z = block_max_z_avx2;
+        vec3_norm = vec3_norm_sse41;
+        matrix_transformation = matrix_transformation_sse41;
+        transform_points = transform_points_sse41;
+        break;
+    case CPU_AVX2:
+        fill_triangle = fill_triangle_avx2;
+        block_max_z = block_max_z_avx2;
+        clear_framebuffer = clear_framebuffer_avx2;
+        clear_zbuffer = clear_zbuffer_avx2;
+        vec3_norm = vec3_norm_sse41;
+        matrix_transformation = matrix_transformation_sse41;
+        transform_points = transform_points_sse41;
+        break;
+    case CPU_SSE41:
+        fill_triangle = fill_triangle_sse41;
+        block_max_z = block_max_z_sse41;
+        clear_framebuffer = clear_framebuffer_sse41;
+        clear_zbuffer = clear_zbuffer_sse41;
+        vec3_norm = vec3_norm_sse41;
+        matrix_transformation = matrix_transformation_sse41;
+        transform_points = transform_points_sse41;
+        break;
+#endif
+
+#ifdef __ARM_NEON__
+    case CPU_NEON:
+        fill_triangle = fill_triangle_neon;
+        block_max_z = block_max_z_neon;
+        clear_framebuffer = clear_framebuffer_neon;
+        clear_zbuffer = clear_zbuffer_neon;
+        vec3_norm = vec3_norm_neon;
+        matrix_transformation = matrix_transformation_neon;
+        transform_points = transform_points_neon;
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
+
+void init_cpu_dispatch(void) {
+    cpu_level_t detected = detect_cpu_level();
+    cpu_level = detected;
+
+    const char *requested = getenv("ENGINE_SIMD");
+    if (requested) {
+        bool found = false;
+        for (int i = CPU_SCALAR; i <= CPU_NEON; i++) {
+            if (strcmp(requested, cpu_level_names[i]) != 0) continue;
+            found = true;
+            if (level_supported(i, detected))
+                cpu_level = i;
+            else
+                fprintf(stderr, "ENGINE_SIMD=%s is not supported, using %s.\n",
+                        requested, cpu_level_name(detected));
+        }
+        if (!found)
+            fprintf(stderr, "Unknown ENGINE_SIMD=%s, using %s.\n", requested,
+                    cpu_level_name(detected));
+    }
+
+    bind_kernels(cpu_level);
+}
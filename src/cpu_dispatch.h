@@ -0,0 +1,21 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+typedef enum {
+    CPU_SCALAR,
+    CPU_SSE41,
+    CPU_AVX2,
+    CPU_AVX512,
+    CPU_NEON,
+} cpu_level_t;
+
+extern cpu_level_t cpu_level;
+
+// Probes the CPU and binds fill_triangle, vec3_norm, matrix_transformation,
+// transform_points and the buffer clears to the best kernels it can run. The ENGINE_SIMD
+// environment variable (scalar, sse41, avx2, avx512 or neon) caps the level,
+// a level the CPU lacks falls back to the detected one.
+void init_cpu_dispatch(void);
+const char *cpu_level_name(cpu_level_t level);
+
+#endif
@@ -20,6 +20,16 @@
         al->length = al->length * 2;                                           \
     })
 
+#define reserve_al(al, len)                                                    \
+    ({                                                                         \
+        assert(al != NULL);                                                    \
+        if (len > al->length) {                                                \
+            al->list = realloc(al->list, sizeof(*al->list) * len);             \
+            assert(al->list != NULL);                                          \
+            al->length = len;                                                  \
+        }                                                                      \
+    })
+
 #define modify_al(al, val, at)                                                 \
     ({                                                                         \
         assert(al != NULL);                                                    \
@@ -63,6 +73,10 @@ void resize_uint_al(uint_arraylist_t *al) {
     resize_al(al);
 }
 
+void reserve_uint_al(uint_arraylist_t *al, unsigned int len) {
+    reserve_al(al, len);
+}
+
 void modify_uint_al(uint_arraylist_t *al, unsigned int val, unsigned int at) {
     modify_al(al, val, at);
 }
@@ -92,6 +106,10 @@ void resize_vec3_al(vec3_arraylist_t *al) {
     resize_al(al);
 }
 
+void reserve_vec3_al(vec3_arraylist_t *al, unsigned int len) {
+    reserve_al(al, len);
+}
+
 void modify_vec3_al(vec3_arraylist_t *al, vec3_t val, unsigned int at) {
     modify_al(al, val, at);
 }
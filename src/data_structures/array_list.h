@@ -7,6 +7,8 @@ typedef struct {
 } uint_arraylist_t;
 
 void init_uint_al(uint_arraylist_t *al, unsigned int start_len);
+// Grows the capacity to at least len without changing the span
+void reserve_uint_al(uint_arraylist_t *al, unsigned int len);
 void modify_uint_al(uint_arraylist_t *al, unsigned int val, unsigned int at);
 void cpy_uint_al(uint_arraylist_t *al,
                  unsigned int *src,
@@ -24,6 +26,7 @@ typedef struct {
 } vec3_arraylist_t;
 
 void init_vec3_al(vec3_arraylist_t *al, unsigned int start_len);
+void reserve_vec3_al(vec3_arraylist_t *al, unsigned int len);
 void modify_vec3_al(vec3_arraylist_t *al, vec3_t val, unsigned int at);
 void append_vec3_al(vec3_arraylist_t *al, vec3_t val);
 void destroy_vec3_al(vec3_arraylist_t *al);
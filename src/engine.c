@@ -3,6 +3,7 @@
 
 #include "./math/graphics_pipeline.h"
 #include "./math/vec3.h"
+#include "./loading/model_cache.h"
 
 void create_engine(engine_t *engine) {
 
@@ -59,28 +60,64 @@ void create_engine(engine_t *engine) {
         engine->fovy, engine->aspect_ratio, -engine->near, -engine->far);
     engine->viewport_transform =
         generate_viewport_transform(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    engine->thread_pool = malloc(sizeof(thread_pool_t));
+    if (!engine->thread_pool ||
+        !create_thread_pool(engine->thread_pool, -1)) {
+        fprintf(stderr, "Thread pool creation failed \n");
+        return;
+    }
+    printf("worker threads: %i\n", engine->thread_pool->thread_count);
 }
 
 void destroy_engine(engine_t *engine) {
     for (int i = 0; i < engine->model_count; i++) {
-        free(engine->models[i]->vertices);
-        free(engine->models[i]->tex_coords);
-        free(engine->models[i]->normals);
-
-        // TODO free textures
-
-        for (int j = 0; j < engine->models[i]->mesh_count; j++) {
-            free(engine->models[i]->meshes[j].v_indices);
-            free(engine->models[i]->meshes[j].n_indices);
-            free(engine->models[i]->meshes[j].t_indices);
-            if (engine->models[i]->meshes[j].mtl)
-                free(engine->models[i]->meshes[j].mtl->name);
+        model_t *model = engine->models[i];
+        free(model->view_x);
+        free(model->view_y);
+        free(model->view_z);
+        free(model->meshlets);
+        free(model->node_meshlets);
+        for (int j = 0; j < model->mesh_count; j++)
+            free(model->meshes[j].face_planes);
+        for (int j = 0; j < model->texture_count; j++) {
+            tex_t *tex = &model->textures[j];
+            // cached levels live in the mapping
+            if (tex->level_count && !model->cache) free(tex->levels[0].data);
+            free(tex->levels);
         }
-        free(engine->models[i]->textures);
-        free(engine->models[i]);
+
+        if (model->cache) {
+            // everything but the struct arrays lives in the mapping
+            unmap_model_cache(model);
+        } else {
+            free(model->vertices);
+            free(model->tex_coords);
+            free(model->normals);
+            free(model->bvh_nodes);
+
+            for (int j = 0; j < model->mesh_count; j++) {
+                free(model->meshes[j].v_indices);
+                free(model->meshes[j].n_indices);
+                free(model->meshes[j].t_indices);
+            }
+            for (int j = 0; j < model->material_count; j++)
+                free(model->materials[j].name);
+            for (int j = 0; j < model->texture_count; j++) {
+                free(model->textures[j].name);
+                free(model->textures[j].data);
+            }
+        }
+        free(model->meshes);
+        free(model->materials);
+        free(model->textures);
+        free(model);
     }
     free(engine->models);
     free(engine->camera);
+
+    destroy_thread_pool(engine->thread_pool);
+    free(engine->thread_pool);
 }
 
 void move_camera(engine_t *engine, float delta_time) {
@@ -2,9 +2,11 @@
 #define ENGINE_H
 
 #include "./math/vec3.h"
+#include "./threading/thread_pool.h"
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define MAX_MESHES 100
 
@@ -16,12 +18,46 @@
 
 #define CLIPPING_PLANES 6
 
+// How a texture is sampled, picked per material with the -filter option of
+// its map statement
+typedef enum {
+    TEX_FILTER_NEAREST,
+    TEX_FILTER_BILINEAR,
+} tex_filter_t;
+
+// Side of the square tiles texture levels are stored in, 4x4 rgba texels
+// fill one 64 byte cache line
+#define TEX_TILE_SIZE 4
+
+// One level of a texture's mip chain. The rgba texels are stored tile by
+// tile, tiles_w tiles to a row, and row by row inside a tile. The level is
+// padded to whole tiles with copies of its last column and row
+typedef struct {
+    uint8_t *data;
+    unsigned int w;
+    unsigned int h;
+    unsigned int tiles_w;
+    // both sides are powers of two, so coordinates wrap with a mask
+    bool pot;
+} tex_level_t;
+
 typedef struct {
     char *name;
     uint8_t *data;
     unsigned int n;
     unsigned int w;
     unsigned int h;
+    // an image named with two filters is loaded once for each
+    tex_filter_t filter;
+
+    // mip chain built from data when the model is parsed, halving down to
+    // 1x1. Every level lives in one allocation, or in the cache mapping when
+    // the model was loaded from it, in which case data is NULL
+    tex_level_t *levels;
+    unsigned int level_count;
+
+    // lowest alpha of the texels of every level, set at load
+    uint8_t min_alpha;
 } tex_t;
 
 typedef struct {
@@ -43,6 +79,32 @@ typedef struct {
     /* char *specular_texname; */
 } mtl_t;
 
+// Node of a mesh bvh. Every node covers the contiguous triangles
+// [first, first + count) of its mesh, an inner node's children are
+// bvh_nodes[left] and bvh_nodes[left + 1] and a leaf has left == 0
+typedef struct {
+    vec3_t min;
+    vec3_t max;
+    unsigned int first;
+    unsigned int count;
+    unsigned int left;
+} bvh_node_t;
+
+// A bvh subtree of up to MESHLET_TRIANGLES triangles with the bounds its
+// facing is tested with. center is the middle of the subtree's box and radius
+// its farthest vertex from it. Every face normal lies within the cone around
+// cone_axis whose half angle has cone_cos and cone_sin, cone_cos is 0 when
+// the normals spread too far for them all to face away at once. cone_offset
+// is the farthest any triangle's plane lies in front of the center
+typedef struct {
+    vec3_t center;
+    float radius;
+    vec3_t cone_axis;
+    float cone_cos;
+    float cone_sin;
+    float cone_offset;
+} meshlet_t;
+
 typedef struct {
     int triangle_count;
     unsigned int *v_indices;
@@ -50,6 +112,22 @@ typedef struct {
     unsigned int *n_indices;
 
     mtl_t *mtl;
+
+    // plane of every triangle, built at load time. xyz is the face normal it
+    // is shaded with and w = -dot(normal, first vertex), so a camera at p
+    // sees the triangle's back when dot(xyz, p) + w > 0
+    vec4_t *face_planes;
+
+    // model space bounds of the vertices the mesh uses, set at load time for
+    // frustum culling. center is the middle of the box and radius the
+    // farthest vertex from it
+    vec3_t aabb_min;
+    vec3_t aabb_max;
+    vec3_t center;
+    float radius;
+
+    // root of the mesh's bvh in model->bvh_nodes
+    unsigned int bvh_root;
 } mesh_t;
 
 typedef struct {
@@ -57,14 +135,40 @@ typedef struct {
     int mesh_count;
 
     int vertex_count;
+    int tex_coord_count;
+    int normal_count;
 
     vec3_t *vertices;
     vec3_t *tex_coords;
     vec3_t *normals;
 
+    // vertices in view space, rewritten every frame by draw_meshes
+    float *view_x;
+    float *view_y;
+    float *view_z;
+
     tex_t *textures;
+    int texture_count;
+
+    mtl_t *materials;
+    int material_count;
 
     mesh_t *meshes;
+
+    // the bvhs of every mesh
+    bvh_node_t *bvh_nodes;
+    int bvh_node_count;
+
+    // built at load time, node_meshlets holds for every bvh node the meshlet
+    // it is the root of, see math/meshlet.h
+    meshlet_t *meshlets;
+    int meshlet_count;
+    unsigned int *node_meshlets;
+
+    // set when the model came from its binary cache, the vertices, indices,
+    // names and texels then point into this mapping instead of the heap
+    void *cache;
+    size_t cache_size;
 } model_t;
 
 typedef struct {
@@ -105,6 +209,8 @@ typedef struct {
 
     vec3_t directional_light; 
 
+    thread_pool_t *thread_pool;
+
 } engine_t;
 
 void create_engine(engine_t *engine);
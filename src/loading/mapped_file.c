@@ -0,0 +1,38 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool map_file(mapped_file_t *file_out, const char *filepath) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    file_out->size = st.st_size;
+    file_out->data = "";
+    if (file_out->size > 0) {
+        void *data = mmap(NULL, file_out->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        posix_madvise(data, file_out->size, POSIX_MADV_SEQUENTIAL);
+        file_out->data = data;
+    }
+    close(fd);
+
+    return true;
+}
+
+void unmap_file(mapped_file_t *file) {
+    if (file->size > 0) munmap((void *)file->data, file->size);
+}
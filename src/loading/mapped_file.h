@@ -0,0 +1,17 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A whole file mapped read only. The parsers read straight from the mapping
+// and never need a null terminated line, an empty file maps to size 0.
+typedef struct {
+    const char *data;
+    size_t size;
+} mapped_file_t;
+
+bool map_file(mapped_file_t *file_out, const char *filepath);
+void unmap_file(mapped_file_t *file);
+
+#endif // !MAPPED_FILE_H
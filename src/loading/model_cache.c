@@ -0,0 +1,588 @@
+#define _POSIX_C_SOURCE 200809L
+// macOS hides st_mtimespec under strict POSIX
+#define _DARWIN_C_SOURCE
+
+#include "model_cache.h"
+#include "mapped_file.h"
+#include "obj_loading.h"
+#include "../math/bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MODEL_CACHE_MAGIC 0x4c444d33 // "3MDL"
+#define SECTION_ALIGNMENT 16
+
+void init_cache_sources(cache_sources_t *sources) {
+    sources->paths = NULL;
+    sources->span = 0;
+    sources->length = 0;
+}
+
+void add_cache_source(cache_sources_t *sources, char *path) {
+    if (sources->span == sources->length) {
+        sources->length = sources->length ? sources->length * 2 : 8;
+        sources->paths =
+            realloc(sources->paths, sizeof(*sources->paths) * sources->length);
+    }
+    sources->paths[sources->span++] = path;
+}
+
+void destroy_cache_sources(cache_sources_t *sources) {
+    for (unsigned int i = 0; i < sources->span; i++) free(sources->paths[i]);
+    free(sources->paths);
+}
+
+static bool cache_enabled(void) {
+    const char *enabled = getenv("ENGINE_MODEL_CACHE");
+    return !enabled || strcmp(enabled, "0") != 0;
+}
+
+static char *get_cache_path(const char *filepath, const char *extension) {
+    char *cache_path = malloc(strlen(filepath) + strlen(extension) + 1);
+    if (!cache_path) return NULL;
+    strcpy(cache_path, filepath);
+    strcat(cache_path, extension);
+    return cache_path;
+}
+
+// 64 bit FNV-1a of the whole file
+static bool hash_file(const char *filepath, uint64_t *hash_out) {
+    mapped_file_t file;
+    if (!map_file(&file, filepath)) return false;
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < file.size; i++) {
+        hash ^= (uint8_t)file.data[i];
+        hash *= 0x100000001b3;
+    }
+    unmap_file(&file);
+
+    *hash_out = hash;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------loading-----------------------------------
+// ---------------------------------------------------------------------------
+
+static bool section_fits(const mapped_file_t *file, uint64_t offset,
+                         uint64_t count, uint64_t element_size) {
+    if (offset > file->size) return false;
+    return count <= (file->size - offset) / element_size;
+}
+
+// A null terminated string inside the file
+static const char *cache_string(const mapped_file_t *file, uint64_t offset) {
+    if (offset >= file->size) return NULL;
+    if (!memchr(&file->data[offset], '\0', file->size - offset)) return NULL;
+    return &file->data[offset];
+}
+
+// macOS names the modification time st_mtimespec
+static struct timespec stat_mtime(const struct stat *st) {
+#ifdef __APPLE__
+    return st->st_mtimespec;
+#else
+    return st->st_mtim;
+#endif
+}
+
+// Sizes and mtimes match on the fast path, a touched file whose hash is still
+// the same keeps the cache too
+static bool sources_unchanged(const mapped_file_t *file,
+                              const cache_header_t *header) {
+    const cache_source_t *sources =
+        (const cache_source_t *)&file->data[header->sources_offset];
+
+    for (uint32_t i = 0; i < header->source_count; i++) {
+        const char *path = cache_string(file, sources[i].path_offset);
+        if (!path) return false;
+
+        struct stat st;
+        if (stat(path, &st) < 0 || st.st_size != sources[i].size) return false;
+        struct timespec mtime = stat_mtime(&st);
+        if (mtime.tv_sec == sources[i].mtime_sec &&
+            mtime.tv_nsec == sources[i].mtime_nsec)
+            continue;
+
+        uint64_t hash;
+        if (!hash_file(path, &hash) || hash != sources[i].hash) return false;
+    }
+
+    return true;
+}
+
+// Every inner node's children come after it and split its triangle range, so
+// a walk from a root never loops or leaves its mesh. No node sits deeper than
+// BVH_MAX_DEPTH either, the walkers' stacks are sized for that.
+static bool bvh_valid(const bvh_node_t *nodes, uint32_t node_count) {
+    // parents come first, so a node's depth is final once it is reached
+    uint8_t *depths = calloc(node_count ? node_count : 1, sizeof(*depths));
+    if (!depths) return false;
+
+    bool valid = true;
+    for (uint32_t i = 0; i < node_count && valid; i++) {
+        const bvh_node_t *node = &nodes[i];
+        if (!node->left) continue;
+        if (node->left <= i || node->left >= node_count - 1 ||
+            depths[i] >= BVH_MAX_DEPTH) {
+            valid = false;
+            break;
+        }
+
+        const bvh_node_t *left = &nodes[node->left];
+        const bvh_node_t *right = &nodes[node->left + 1];
+        valid = left->first == node->first &&
+                right->first == node->first + left->count &&
+                (uint64_t)left->count + right->count == node->count;
+
+        for (uint32_t j = node->left; j <= node->left + 1; j++) {
+            if (depths[j] < depths[i] + 1) depths[j] = depths[i] + 1;
+        }
+    }
+
+    free(depths);
+    return valid;
+}
+
+// Indices past the end of their array would be read straight out of the
+// mapping, missing texture coordinates and normals are stored as -1
+static bool indices_valid(const unsigned int *indices, uint64_t count,
+                          uint32_t limit, bool optional) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (optional && indices[i] == (unsigned int)-1) continue;
+        if (indices[i] >= limit) return false;
+    }
+    return true;
+}
+
+// A material's texture is -1 or one that decoded
+static bool tex_idx_valid(const model_t *model, uint32_t idx) {
+    if (idx == (uint32_t)-1) return true;
+    return idx < model->texture_count && model->textures[idx].level_count;
+}
+
+// Points tex's levels at its mip chain in the file. The chain has to be the
+// one the loader would build now, a cache written with another
+// ENGINE_POT_TEXTURES setting holds levels of the wrong size
+static bool fill_levels(const mapped_file_t *file,
+                        const cache_tex_t *cache_tex, tex_t *tex) {
+    if (!cache_tex->levels_offset) return cache_tex->level_count == 0;
+
+    // stb_image decodes nothing wider or taller than 1 << 24
+    if (!cache_tex->w || !cache_tex->h || cache_tex->w > 1 << 24 ||
+        cache_tex->h > 1 << 24)
+        return false;
+    unsigned int base_w, base_h;
+    tex_base_size(cache_tex->w, cache_tex->h, &base_w, &base_h);
+    if (cache_tex->base_w != base_w || cache_tex->base_h != base_h)
+        return false;
+
+    unsigned int level_count;
+    size_t bytes = tex_chain_size(base_w, base_h, &level_count);
+    if (cache_tex->level_count != level_count ||
+        !section_fits(file, cache_tex->levels_offset, bytes, 1))
+        return false;
+
+    tex->levels = malloc(sizeof(tex_level_t) * level_count);
+    if (!tex->levels) return false;
+    tex->level_count = level_count;
+    lay_out_tex_levels(tex, (uint8_t *)&file->data[cache_tex->levels_offset],
+                       base_w, base_h);
+    tex->min_alpha = cache_tex->min_alpha;
+    return true;
+}
+
+static bool fill_model(const mapped_file_t *file, const cache_header_t *header,
+                       model_t *model) {
+    char *data = (char *)file->data;
+
+    // the caller frees these on failure
+    model->textures = NULL;
+    model->materials = NULL;
+    model->meshes = NULL;
+
+    const cache_mesh_t *cache_meshes =
+        (const cache_mesh_t *)&data[header->meshes_offset];
+    const cache_mtl_t *cache_mtls =
+        (const cache_mtl_t *)&data[header->materials_offset];
+    const cache_tex_t *cache_texs =
+        (const cache_tex_t *)&data[header->textures_offset];
+
+    model->vertex_count = header->vertex_count;
+    model->tex_coord_count = header->tex_coord_count;
+    model->normal_count = header->normal_count;
+    model->vertices = (vec3_t *)&data[header->vertices_offset];
+    model->tex_coords = header->tex_coord_count
+                            ? (vec3_t *)&data[header->tex_coords_offset]
+                            : NULL;
+    model->normals =
+        header->normal_count ? (vec3_t *)&data[header->normals_offset] : NULL;
+
+    model->bvh_node_count = header->bvh_node_count;
+    model->bvh_nodes = (bvh_node_t *)&data[header->bvh_nodes_offset];
+    if (!bvh_valid(model->bvh_nodes, header->bvh_node_count)) return false;
+
+    model->texture_count = header->texture_count;
+    if (header->texture_count) {
+        // zeroed so the caller can free the levels of any of them
+        model->textures = calloc(header->texture_count, sizeof(tex_t));
+        if (!model->textures) return false;
+    }
+    for (uint32_t i = 0; i < header->texture_count; i++) {
+        const cache_tex_t *cache_tex = &cache_texs[i];
+        tex_t *tex = &model->textures[i];
+        *tex = (tex_t){
+            .name = (char *)cache_string(file, cache_tex->name_offset),
+            .data = NULL,
+            .n = cache_tex->n,
+            .w = cache_tex->w,
+            .h = cache_tex->h,
+            .filter = cache_tex->filter == TEX_FILTER_BILINEAR
+                          ? TEX_FILTER_BILINEAR
+                          : TEX_FILTER_NEAREST,
+        };
+        if (!tex->name || !fill_levels(file, cache_tex, tex)) return false;
+    }
+
+    model->material_count = header->material_count;
+    if (header->material_count) {
+        model->materials = malloc(sizeof(mtl_t) * header->material_count);
+        if (!model->materials) return false;
+    }
+    for (uint32_t i = 0; i < header->material_count; i++) {
+        const cache_mtl_t *cache_mtl = &cache_mtls[i];
+        mtl_t *mtl = &model->materials[i];
+        mtl->name = (char *)cache_string(file, cache_mtl->name_offset);
+        if (!mtl->name) return false;
+        memcpy(mtl->ambient, cache_mtl->ambient, sizeof(mtl->ambient));
+        memcpy(mtl->diffuse, cache_mtl->diffuse, sizeof(mtl->diffuse));
+        memcpy(mtl->specular, cache_mtl->specular, sizeof(mtl->specular));
+        mtl->specular_exp = cache_mtl->specular_exp;
+        mtl->optical_density = cache_mtl->optical_density;
+        mtl->dissolved = cache_mtl->dissolved;
+        mtl->illum = cache_mtl->illum;
+        mtl->ambient_tex_idx = cache_mtl->ambient_tex_idx;
+        mtl->diffuse_tex_idx = cache_mtl->diffuse_tex_idx;
+        mtl->specular_tex_idx = cache_mtl->specular_tex_idx;
+        if (!tex_idx_valid(model, mtl->ambient_tex_idx) ||
+            !tex_idx_valid(model, mtl->diffuse_tex_idx) ||
+            !tex_idx_valid(model, mtl->specular_tex_idx))
+            return false;
+    }
+
+    model->mesh_count = header->mesh_count;
+    model->meshes = malloc(sizeof(mesh_t) * (header->mesh_count + 1));
+    if (!model->meshes) return false;
+    for (uint32_t i = 0; i < header->mesh_count; i++) {
+        const cache_mesh_t *cache_mesh = &cache_meshes[i];
+        mesh_t *mesh = &model->meshes[i];
+        uint64_t index_count = (uint64_t)cache_mesh->triangle_count * 3;
+        if (!section_fits(file, cache_mesh->v_indices_offset, index_count, 4) ||
+            !section_fits(file, cache_mesh->t_indices_offset, index_count, 4) ||
+            !section_fits(file, cache_mesh->n_indices_offset, index_count, 4))
+            return false;
+        if (cache_mesh->material >= (int32_t)header->material_count)
+            return false;
+        if (cache_mesh->bvh_root >= header->bvh_node_count) return false;
+        const bvh_node_t *root = &model->bvh_nodes[cache_mesh->bvh_root];
+        if (root->first != 0 || root->count != cache_mesh->triangle_count)
+            return false;
+
+        mesh->triangle_count = cache_mesh->triangle_count;
+        mesh->v_indices = (unsigned int *)&data[cache_mesh->v_indices_offset];
+        mesh->t_indices = (unsigned int *)&data[cache_mesh->t_indices_offset];
+        mesh->n_indices = (unsigned int *)&data[cache_mesh->n_indices_offset];
+        mesh->mtl = cache_mesh->material >= 0
+                        ? &model->materials[cache_mesh->material]
+                        : NULL;
+        mesh->bvh_root = cache_mesh->bvh_root;
+        if (!indices_valid(mesh->v_indices, index_count, header->vertex_count,
+                           false) ||
+            !indices_valid(mesh->t_indices, index_count,
+                           header->tex_coord_count, true) ||
+            !indices_valid(mesh->n_indices, index_count, header->normal_count,
+                           true))
+            return false;
+    }
+
+    model->cache = data;
+    model->cache_size = file->size;
+
+    return true;
+}
+
+bool load_model_cache(const char *filepath, model_t *model) {
+    if (!cache_enabled()) return false;
+
+    char *cache_path = get_cache_path(filepath, ".cache");
+    if (!cache_path) return false;
+
+    mapped_file_t file;
+    if (!map_file(&file, cache_path)) {
+        free(cache_path);
+        return false;
+    }
+
+    const cache_header_t *header = (const cache_header_t *)file.data;
+    bool valid =
+        file.size >= sizeof(*header) && header->magic == MODEL_CACHE_MAGIC &&
+        header->version == MODEL_CACHE_VERSION &&
+        header->file_size == file.size &&
+        section_fits(&file, header->sources_offset, header->source_count,
+                     sizeof(cache_source_t)) &&
+        section_fits(&file, header->vertices_offset, header->vertex_count,
+                     sizeof(vec3_t)) &&
+        section_fits(&file, header->tex_coords_offset,
+                     header->tex_coord_count, sizeof(vec3_t)) &&
+        section_fits(&file, header->normals_offset, header->normal_count,
+                     sizeof(vec3_t)) &&
+        section_fits(&file, header->bvh_nodes_offset, header->bvh_node_count,
+                     sizeof(bvh_node_t)) &&
+        section_fits(&file, header->meshes_offset, header->mesh_count,
+                     sizeof(cache_mesh_t)) &&
+        section_fits(&file, header->materials_offset, header->material_count,
+                     sizeof(cache_mtl_t)) &&
+        section_fits(&file, header->textures_offset, header->texture_count,
+                     sizeof(cache_tex_t));
+
+    if (valid && !sources_unchanged(&file, header)) {
+        printf("Model cache is out of date: %s\n", cache_path);
+        valid = false;
+    }
+
+    if (valid && !fill_model(&file, header, model)) {
+        fprintf(stderr, "Error reading model cache: %s\n", cache_path);
+        for (uint32_t i = 0; model->textures && i < header->texture_count;
+             i++)
+            free(model->textures[i].levels);
+        free(model->textures);
+        free(model->materials);
+        free(model->meshes);
+        valid = false;
+    }
+
+    if (valid)
+        printf("Loaded model cache: %s\n", cache_path);
+    else
+        unmap_file(&file);
+    free(cache_path);
+
+    return valid;
+}
+
+void unmap_model_cache(model_t *model) {
+    mapped_file_t file = {model->cache, model->cache_size};
+    unmap_file(&file);
+    model->cache = NULL;
+    model->cache_size = 0;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------saving------------------------------------
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    FILE *fp;
+    uint64_t offset;
+    bool failed;
+} cache_writer_t;
+
+// Appends data at the next aligned offset and returns that offset
+static uint64_t write_section(cache_writer_t *writer, const void *data,
+                              uint64_t size) {
+    static const char zeros[SECTION_ALIGNMENT] = {0};
+    uint64_t padding =
+        (SECTION_ALIGNMENT - writer->offset % SECTION_ALIGNMENT) %
+        SECTION_ALIGNMENT;
+    if (padding && fwrite(zeros, 1, padding, writer->fp) != padding)
+        writer->failed = true;
+    writer->offset += padding;
+
+    uint64_t offset = writer->offset;
+    if (size && fwrite(data, 1, size, writer->fp) != size)
+        writer->failed = true;
+    writer->offset += size;
+
+    return offset;
+}
+
+static uint64_t write_string(cache_writer_t *writer, const char *string) {
+    return write_section(writer, string, strlen(string) + 1);
+}
+
+static bool write_sources(cache_writer_t *writer, cache_header_t *header,
+                          const cache_sources_t *sources) {
+    cache_source_t *cache_sources =
+        calloc(sources->span ? sources->span : 1, sizeof(*cache_sources));
+    if (!cache_sources) return false;
+
+    for (unsigned int i = 0; i < sources->span; i++) {
+        struct stat st;
+        if (stat(sources->paths[i], &st) < 0 ||
+            !hash_file(sources->paths[i], &cache_sources[i].hash)) {
+            free(cache_sources);
+            return false;
+        }
+        cache_sources[i].path_offset = write_string(writer, sources->paths[i]);
+        cache_sources[i].size = st.st_size;
+        struct timespec mtime = stat_mtime(&st);
+        cache_sources[i].mtime_sec = mtime.tv_sec;
+        cache_sources[i].mtime_nsec = mtime.tv_nsec;
+    }
+
+    header->source_count = sources->span;
+    header->sources_offset = write_section(
+        writer, cache_sources, sizeof(*cache_sources) * sources->span);
+    free(cache_sources);
+
+    return true;
+}
+
+static bool write_model(cache_writer_t *writer, cache_header_t *header,
+                        const model_t *model) {
+    header->vertex_count = model->vertex_count;
+    header->tex_coord_count = model->tex_coord_count;
+    header->normal_count = model->normal_count;
+    header->vertices_offset = write_section(
+        writer, model->vertices, sizeof(vec3_t) * model->vertex_count);
+    header->tex_coords_offset = write_section(
+        writer, model->tex_coords, sizeof(vec3_t) * model->tex_coord_count);
+    header->normals_offset = write_section(
+        writer, model->normals, sizeof(vec3_t) * model->normal_count);
+
+    cache_mesh_t *cache_meshes =
+        calloc(model->mesh_count + 1, sizeof(*cache_meshes));
+    cache_mtl_t *cache_mtls =
+        calloc(model->material_count + 1, sizeof(*cache_mtls));
+    cache_tex_t *cache_texs =
+        calloc(model->texture_count + 1, sizeof(*cache_texs));
+    if (!cache_meshes || !cache_mtls || !cache_texs) {
+        free(cache_meshes);
+        free(cache_mtls);
+        free(cache_texs);
+        return false;
+    }
+
+    for (int i = 0; i < model->mesh_count; i++) {
+        const mesh_t *mesh = &model->meshes[i];
+        uint64_t size = sizeof(unsigned int) * mesh->triangle_count * 3;
+        cache_meshes[i] = (cache_mesh_t){
+            .triangle_count = mesh->triangle_count,
+            .material = mesh->mtl ? mesh->mtl - model->materials : -1,
+            .bvh_root = mesh->bvh_root,
+            .v_indices_offset = write_section(writer, mesh->v_indices, size),
+            .t_indices_offset = write_section(writer, mesh->t_indices, size),
+            .n_indices_offset = write_section(writer, mesh->n_indices, size),
+        };
+    }
+
+    for (int i = 0; i < model->texture_count; i++) {
+        const tex_t *tex = &model->textures[i];
+        cache_texs[i] = (cache_tex_t){
+            .name_offset = write_string(writer, tex->name),
+            .n = tex->n,
+            .w = tex->w,
+            .h = tex->h,
+            .filter = tex->filter,
+            .level_count = tex->level_count,
+            .min_alpha = tex->min_alpha,
+        };
+        if (tex->level_count) {
+            unsigned int level_count;
+            cache_texs[i].base_w = tex->levels[0].w;
+            cache_texs[i].base_h = tex->levels[0].h;
+            cache_texs[i].levels_offset = write_section(
+                writer, tex->levels[0].data,
+                tex_chain_size(tex->levels[0].w, tex->levels[0].h,
+                               &level_count));
+        }
+    }
+
+    for (int i = 0; i < model->material_count; i++) {
+        const mtl_t *mtl = &model->materials[i];
+        cache_mtl_t *cache_mtl = &cache_mtls[i];
+        cache_mtl->name_offset = write_string(writer, mtl->name);
+        memcpy(cache_mtl->ambient, mtl->ambient, sizeof(mtl->ambient));
+        memcpy(cache_mtl->diffuse, mtl->diffuse, sizeof(mtl->diffuse));
+        memcpy(cache_mtl->specular, mtl->specular, sizeof(mtl->specular));
+        cache_mtl->specular_exp = mtl->specular_exp;
+        cache_mtl->optical_density = mtl->optical_density;
+        cache_mtl->dissolved = mtl->dissolved;
+        cache_mtl->illum = mtl->illum;
+        cache_mtl->ambient_tex_idx = mtl->ambient_tex_idx;
+        cache_mtl->diffuse_tex_idx = mtl->diffuse_tex_idx;
+        cache_mtl->specular_tex_idx = mtl->specular_tex_idx;
+    }
+
+    header->bvh_node_count = model->bvh_node_count;
+    header->bvh_nodes_offset = write_section(
+        writer, model->bvh_nodes, sizeof(bvh_node_t) * model->bvh_node_count);
+
+    header->mesh_count = model->mesh_count;
+    header->material_count = model->material_count;
+    header->texture_count = model->texture_count;
+    header->meshes_offset = write_section(
+        writer, cache_meshes, sizeof(*cache_meshes) * model->mesh_count);
+    header->materials_offset = write_section(
+        writer, cache_mtls, sizeof(*cache_mtls) * model->material_count);
+    header->textures_offset = write_section(
+        writer, cache_texs, sizeof(*cache_texs) * model->texture_count);
+
+    free(cache_meshes);
+    free(cache_mtls);
+    free(cache_texs);
+
+    return true;
+}
+
+void save_model_cache(const char *filepath, const model_t *model,
+                      const cache_sources_t *sources) {
+    if (!cache_enabled()) return;
+
+    char *cache_path = get_cache_path(filepath, ".cache");
+    char *tmp_path = get_cache_path(filepath, ".cache.tmp");
+    if (!cache_path || !tmp_path) {
+        free(cache_path);
+        free(tmp_path);
+        return;
+    }
+
+    // written to a temporary file and renamed, a crash halfway never leaves a
+    // truncated cache behind
+    cache_writer_t writer = {fopen(tmp_path, "wb"), 0, false};
+    if (!writer.fp) {
+        printf("Could not write model cache: %s\n", tmp_path);
+        free(cache_path);
+        free(tmp_path);
+        return;
+    }
+
+    cache_header_t header = {0};
+    write_section(&writer, &header, sizeof(header));
+
+    bool written = write_sources(&writer, &header, sources) &&
+                   write_model(&writer, &header, model);
+
+    header.magic = MODEL_CACHE_MAGIC;
+    header.version = MODEL_CACHE_VERSION;
+    header.file_size = writer.offset;
+    if (fseek(writer.fp, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, writer.fp) != 1)
+        writer.failed = true;
+
+    if (fclose(writer.fp) != 0) writer.failed = true;
+
+    if (written && !writer.failed && rename(tmp_path, cache_path) == 0) {
+        printf("Wrote model cache: %s\n", cache_path);
+    } else {
+        printf("Could not write model cache: %s\n", cache_path);
+        remove(tmp_path);
+    }
+
+    free(cache_path);
+    free(tmp_path);
+}
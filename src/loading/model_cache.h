@@ -0,0 +1,117 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include "../engine.h"
+
+// Bump whenever the layout below or any struct written raw (vec3_t,
+// bvh_node_t) changes, older caches are then rebuilt from the .obj
+#define MODEL_CACHE_VERSION 4
+
+// A parsed model written next to its .obj as <file>.obj.cache. Every section
+// starts 16 byte aligned and holds the same arrays the parser builds, so a
+// load maps the file and points the model straight into it. The .obj, .mtl
+// and texture files it was built from are listed with their size, mtime and
+// FNV-1a hash, a cache whose sources changed is ignored and rewritten.
+//
+// header, sources[], vertices[], tex_coords[], normals[],
+// per mesh v/t/n indices, mip chains, strings, bvh_nodes[], meshes[],
+// materials[], textures[]
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+
+    uint32_t source_count;
+    uint32_t vertex_count;
+    uint32_t tex_coord_count;
+    uint32_t normal_count;
+    uint32_t mesh_count;
+    uint32_t material_count;
+    uint32_t texture_count;
+    uint32_t bvh_node_count;
+
+    uint64_t sources_offset;
+    uint64_t vertices_offset;
+    uint64_t tex_coords_offset;
+    uint64_t normals_offset;
+    uint64_t bvh_nodes_offset;
+    uint64_t meshes_offset;
+    uint64_t materials_offset;
+    uint64_t textures_offset;
+} cache_header_t;
+
+typedef struct {
+    uint64_t path_offset;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+} cache_source_t;
+
+typedef struct {
+    uint32_t triangle_count;
+    // index into the materials, -1 for none
+    int32_t material;
+    uint32_t bvh_root;
+    uint32_t padding;
+    // triangle_count * 3 indices each
+    uint64_t v_indices_offset;
+    uint64_t t_indices_offset;
+    uint64_t n_indices_offset;
+} cache_mesh_t;
+
+typedef struct {
+    uint64_t name_offset;
+
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float specular_exp;
+    float optical_density;
+    float dissolved;
+    float illum;
+
+    uint32_t ambient_tex_idx;
+    uint32_t diffuse_tex_idx;
+    uint32_t specular_tex_idx;
+} cache_mtl_t;
+
+typedef struct {
+    uint64_t name_offset;
+    // the tiled mip chain, level after level from base_w x base_h down, 0
+    // when the image failed to decode
+    uint64_t levels_offset;
+    uint32_t n;
+    uint32_t w;
+    uint32_t h;
+    uint32_t filter;
+    uint32_t base_w;
+    uint32_t base_h;
+    uint32_t level_count;
+    uint32_t min_alpha;
+} cache_tex_t;
+
+// Files a model was built from, the cache is only valid while they are
+// unchanged
+typedef struct {
+    char **paths;
+    unsigned int span;
+    unsigned int length;
+} cache_sources_t;
+
+void init_cache_sources(cache_sources_t *sources);
+// Takes ownership of path
+void add_cache_source(cache_sources_t *sources, char *path);
+void destroy_cache_sources(cache_sources_t *sources);
+
+// Fills the model from filepath's cache when it exists and its sources are
+// unchanged. Setting ENGINE_MODEL_CACHE=0 in the environment disables the
+// cache for both loading and saving.
+bool load_model_cache(const char *filepath, model_t *model);
+// Writes filepath's cache for a model the parser just built, failing to is
+// not an error
+void save_model_cache(const char *filepath, const model_t *model,
+                      const cache_sources_t *sources);
+void unmap_model_cache(model_t *model);
+
+#endif // !MODEL_CACHE_H
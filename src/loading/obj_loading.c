@@ -1,16 +1,30 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "obj_loading.h"
+#include "mapped_file.h"
+#include "model_cache.h"
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../../utils/stb_image.h"
+// the resizer defines helpers and keeps values that only some of its paths
+// use
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "../../utils/stb_image_resize2.h"
+#pragma GCC diagnostic pop
 
 #include "../data_structures/array_list.h"
+#include "../math/bvh.h"
+#include "../math/graphics_pipeline.h"
+#include "../math/meshlet.h"
 
-#define BUFFER_SIZE 1024
-#define VEC_START_SIZE 0x2000
-#define INDEX_START_SIZE 0x2000
 #define MESH_START_SIZE 0x5
 #define MTL_START_SIZE 0x5
 #define TEX_START_SIZE 0x5
@@ -43,11 +57,10 @@ typedef enum {
     MAP_KS,
 } LINE_CODE;
 
-char *get_filepath(const char *path, const char *filename) {
+char *get_filepath(const char *path, const char *filename, int filename_len) {
     int len_path = strlen(path);
-    int len_filename = strlen(filename);
 
-    char *filepath = malloc(sizeof(*filepath) * (len_path + len_filename + 1));
+    char *filepath = malloc(sizeof(*filepath) * (len_path + filename_len + 1));
 
     int j = 0;
     int i = 0;
@@ -55,133 +68,501 @@ char *get_filepath(const char *path, const char *filename) {
         if (path[j] != '\n' && path[j] != '\r') { filepath[i++] = path[j]; }
         j++;
     }
-    j = 0;
-    while (filename[j] != '\0') {
+    for (j = 0; j < filename_len; j++) {
         if (filename[j] != '\n' && filename[j] != '\r') {
             filepath[i++] = filename[j];
         }
-        j++;
     }
     filepath[i] = '\0';
 
     return filepath;
 }
 
-void parse_single_float(float *float_out, char *line_in) {
-    assert(line_in);
-    char *token = strtok(line_in, " ");
-    *float_out = atof(token);
+static bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+static const char *skip_blanks(const char *line, const char *end) {
+    while (line < end && is_blank(*line)) line++;
+    return line;
 }
 
-void parse_triple_float(float triple_out[3], char *line_in) {
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Exactly representable in a double, so scaling by them rounds only once
+static const double powers_of_10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// [+-]digits[.digits][(e|E)[+-]digits], returns the first character after the
+// number or NULL when there is no number at line
+static const char *parse_float(const char *line, const char *end,
+                               float *float_out) {
+    const char *c = line;
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+')) negative = *c++ == '-';
+
+    // up to 19 significant digits fit in the mantissa, the rest only move the
+    // exponent
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    for (; c < end && is_digit(*c); c++) {
+        has_digits = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*c - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (c < end && *c == '.') {
+        for (c++; c < end && is_digit(*c); c++) {
+            has_digits = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*c - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!has_digits) return NULL;
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        bool negative_exp = false;
+        if (e < end && (*e == '-' || *e == '+')) negative_exp = *e++ == '-';
+        if (e < end && is_digit(*e)) {
+            int exp = 0;
+            for (; e < end && is_digit(*e); e++)
+                if (exp < 10000) exp = exp * 10 + (*e - '0');
+            exponent += negative_exp ? -exp : exp;
+            c = e;
+        }
+    }
+
+    double value = mantissa;
+    if (exponent >= 0 && exponent <= 22)
+        value *= powers_of_10[exponent];
+    else if (exponent < 0 && exponent >= -22)
+        value /= powers_of_10[-exponent];
+    else
+        value *= pow(10, exponent);
+
+    *float_out = negative ? -value : value;
+    return c;
+}
+
+// [+-]digits, returns the first character after the number or NULL when there
+// is no number at line
+static const char *parse_int(const char *line, const char *end, int *int_out) {
+    const char *c = line;
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+')) negative = *c++ == '-';
+    if (c == end || !is_digit(*c)) return NULL;
+
+    int res = 0;
+    for (; c < end && is_digit(*c); c++) res = res * 10 + (*c - '0');
+
+    *int_out = negative ? -res : res;
+    return c;
+}
+
+void parse_single_float(float *float_out, const char *line_in,
+                        const char *end) {
     assert(line_in);
-    char *token = strtok(line_in, " ");
-    triple_out[0] = atof(token);
-    token = strtok(NULL, " ");
-    triple_out[1] = atof(token);
-    token = strtok(NULL, " ");
-    triple_out[2] = atof(token);
+    parse_float(skip_blanks(line_in, end), end, float_out);
 }
 
-void load_tex(unsigned int *idx_out, tex_arraylist_t *txts_out, char *line_in,
-              const char *path) {
+void parse_triple_float(float triple_out[3], const char *line_in,
+                        const char *end) {
     assert(line_in);
-    assert(txts_out);
-    while (line_in[0] && (line_in[0] == ' ' || line_in[0] == '\t')) line_in++;
+    for (int i = 0; i < 3; i++) {
+        line_in = parse_float(skip_blanks(line_in, end), end, &triple_out[i]);
+        if (!line_in) return;
+    }
+}
+
+// Copies the w x h texels of rows, stored row by row, into the tiles of
+// level
+static void tile_level(const uint8_t *rows, const tex_level_t *level) {
+    uint8_t *texel = level->data;
+    unsigned int tiles_h = (level->h + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+    for (unsigned int tile_y = 0; tile_y < tiles_h; tile_y++) {
+        for (unsigned int tile_x = 0; tile_x < level->tiles_w; tile_x++) {
+            for (unsigned int y = 0; y < TEX_TILE_SIZE; y++) {
+                unsigned int v = tile_y * TEX_TILE_SIZE + y;
+                v = v < level->h ? v : level->h - 1;
+                for (unsigned int x = 0; x < TEX_TILE_SIZE; x++) {
+                    unsigned int u = tile_x * TEX_TILE_SIZE + x;
+                    u = u < level->w ? u : level->w - 1;
+                    memcpy(texel, &rows[((size_t)v * level->w + u) * 4], 4);
+                    texel += 4;
+                }
+            }
+        }
+    }
+}
+
+static size_t tiled_size(unsigned int w, unsigned int h) {
+    size_t tiles_w = (w + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+    size_t tiles_h = (h + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+    return tiles_w * tiles_h * TEX_TILE_SIZE * TEX_TILE_SIZE * 4;
+}
+
+static bool pot_textures_enabled(void) {
+    const char *enabled = getenv("ENGINE_POT_TEXTURES");
+    return !enabled || strcmp(enabled, "0") != 0;
+}
+
+static unsigned int next_pot(unsigned int n) {
+    unsigned int pot = 1;
+    while (pot < n) pot *= 2;
+    return pot;
+}
+
+void tex_base_size(unsigned int w, unsigned int h, unsigned int *base_w,
+                   unsigned int *base_h) {
+    *base_w = w;
+    *base_h = h;
+    if (pot_textures_enabled()) {
+        *base_w = next_pot(w);
+        *base_h = next_pot(h);
+    }
+}
+
+size_t tex_chain_size(unsigned int w, unsigned int h,
+                      unsigned int *level_count) {
+    size_t bytes = tiled_size(w, h);
+    *level_count = 1;
+    while (w > 1 || h > 1) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        bytes += tiled_size(w, h);
+        (*level_count)++;
+    }
+    return bytes;
+}
+
+void lay_out_tex_levels(tex_t *tex, uint8_t *data, unsigned int w,
+                        unsigned int h) {
+    for (unsigned int i = 0; i < tex->level_count; i++) {
+        tex_level_t *level = &tex->levels[i];
+        level->data = data;
+        level->w = w;
+        level->h = h;
+        level->tiles_w = (w + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+        level->pot = !(w & (w - 1)) && !(h & (h - 1));
+        data += tiled_size(w, h);
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+}
+
+// Every level is resized from the one above it, alpha weighted so the
+// color of transparent texels doesn't bleed in, then tiled. A texture whose
+// sides aren't powers of two is first resampled up to the next ones. The
+// untiled levels only live until the chain is built
+static bool build_mip_chain(tex_t *tex) {
+    tex->levels = NULL;
+    tex->level_count = 0;
+    if (!tex->data) return true;
+
+    unsigned int w, h;
+    tex_base_size(tex->w, tex->h, &w, &h);
+    bool resample = w != tex->w || h != tex->h;
+
+    unsigned int level_count;
+    size_t tiled_bytes = tex_chain_size(w, h, &level_count);
+    size_t mip_texels = resample ? (size_t)w * h : 0;
+    for (unsigned int mip_w = w, mip_h = h; mip_w > 1 || mip_h > 1;) {
+        mip_w = mip_w > 1 ? mip_w / 2 : 1;
+        mip_h = mip_h > 1 ? mip_h / 2 : 1;
+        mip_texels += (size_t)mip_w * mip_h;
+    }
+
+    tex->levels = malloc(sizeof(tex_level_t) * level_count);
+    uint8_t *tiled = malloc(tiled_bytes);
+    uint8_t *mip_rows = mip_texels ? malloc(mip_texels * 4) : NULL;
+    if (!tex->levels || !tiled || (mip_texels && !mip_rows)) {
+        fprintf(stderr, "Error allocating mip chain.\n");
+        free(tex->levels);
+        free(tiled);
+        free(mip_rows);
+        tex->levels = NULL;
+        return false;
+    }
+    tex->level_count = level_count;
+    lay_out_tex_levels(tex, tiled, w, h);
+
+    const uint8_t *rows = tex->data;
+    uint8_t *next_rows = mip_rows;
+    if (resample) {
+        stbir_resize_uint8_srgb(rows, tex->w, tex->h, 0, next_rows, w, h, 0,
+                                STBIR_RGBA);
+        rows = next_rows;
+        next_rows += (size_t)w * h * 4;
+    }
+    for (unsigned int i = 0; i < level_count; i++) {
+        const tex_level_t *level = &tex->levels[i];
+        if (i > 0) {
+            const tex_level_t *above = &tex->levels[i - 1];
+            stbir_resize_uint8_srgb(rows, above->w, above->h, 0, next_rows,
+                                    level->w, level->h, 0, STBIR_RGBA);
+            rows = next_rows;
+            next_rows += (size_t)level->w * level->h * 4;
+        }
+        tile_level(rows, level);
+    }
+    free(mip_rows);
+    return true;
+}
+
+static void compute_min_alpha(tex_t *tex) {
+    tex->min_alpha = 0;
+    if (!tex->level_count) return;
+
+    // filtering can ring below the alpha of the level above, the padding
+    // only repeats texels
+    uint8_t min_alpha = 0xFF;
+    for (unsigned int i = 0; i < tex->level_count; i++) {
+        const tex_level_t *level = &tex->levels[i];
+        size_t texel_count = tiled_size(level->w, level->h) / 4;
+        for (size_t j = 0; j < texel_count; j++) {
+            uint8_t alpha = level->data[j * 4 + 3];
+            min_alpha = alpha < min_alpha ? alpha : min_alpha;
+        }
+    }
+    tex->min_alpha = min_alpha;
+}
+
+// One texture decoding and building its mip chain on the pool. It owns its
+// results until the load waits on the pool, the texture list may grow
+// meanwhile so it can't write there
+typedef struct {
+    char *filepath;
+    unsigned int tex_idx;
+
+    // only the texels, size and levels are filled in
+    tex_t tex;
+    bool built;
+} tex_decode_t;
+
+// Textures named by the .mtl files. load_tex hands out the index a texture
+// will have right away and its texels show up once finish_textures ran.
+typedef struct {
+    tex_arraylist_t list;
+    thread_pool_t *pool;
+
+    tex_decode_t **decodes;
+    unsigned int decode_span;
+    unsigned int decode_length;
+} tex_loader_t;
+
+static void decode_tex(void *arg) {
+    tex_decode_t *decode = arg;
+    tex_t *tex = &decode->tex;
+    int w, h, n;
+    tex->data = stbi_load(decode->filepath, &w, &h, &n, 4);
+    if (!tex->data) return;
+    tex->w = w;
+    tex->h = h;
+    tex->n = n;
+
+    decode->built = build_mip_chain(tex);
+    if (decode->built) compute_min_alpha(tex);
+}
+
+static int token_len(const char *line, const char *end) {
     int len = 0;
-    char *end_name_ptr = line_in;
-    while (end_name_ptr[0] && end_name_ptr[0] != ' ' &&
-           end_name_ptr[0] != '\t' && end_name_ptr[0] != '\n' &&
-           end_name_ptr[0] != '\r') {
-        len++;
-        end_name_ptr++;
+    while (&line[len] < end && !is_blank(line[len])) len++;
+    return len;
+}
+
+// The file name can follow a -filter nearest or -filter bilinear option
+void load_tex(unsigned int *idx_out, tex_loader_t *texs_out,
+              const char *line_in, const char *end, const char *path) {
+    assert(line_in);
+    assert(texs_out);
+    tex_filter_t filter = TEX_FILTER_NEAREST;
+    line_in = skip_blanks(line_in, end);
+    int len = token_len(line_in, end);
+    if (len == 7 && strncmp(line_in, "-filter", len) == 0) {
+        line_in = skip_blanks(&line_in[len], end);
+        len = token_len(line_in, end);
+        if (len == 8 && strncmp(line_in, "bilinear", len) == 0)
+            filter = TEX_FILTER_BILINEAR;
+        else if (len != 7 || strncmp(line_in, "nearest", len) != 0)
+            printf("Unknown texture filter: %.*s\n", len, line_in);
+        line_in = skip_blanks(&line_in[len], end);
+        len = token_len(line_in, end);
     }
-    *end_name_ptr = '\0';
 
+    tex_arraylist_t *txts_out = &texs_out->list;
     *idx_out = 0;
-    char *tex_filename = line_in;
     tex_t *al_ptr = txts_out->list;
     while (*idx_out < txts_out->span && al_ptr) {
-        if (strncmp(tex_filename, al_ptr->name, len) == 0) return;
+        if (strlen(al_ptr->name) == len &&
+            strncmp(line_in, al_ptr->name, len) == 0 &&
+            al_ptr->filter == filter)
+            return;
         (*idx_out)++;
         al_ptr++;
     }
 
-    char *tex_filepath = get_filepath(path, tex_filename);
-    tex_filename = strdup(tex_filename);
-    int x, y, n, ok;
-    ok = stbi_info(tex_filepath, &x, &y, &n);
-    if (!ok) {
-        printf("failure reason: %s\n", stbi_failure_reason());
-        printf("could not get texture info: %.*s\n", len, tex_filepath);
-        free(tex_filepath);
+    tex_decode_t *decode = calloc(1, sizeof(*decode));
+    if (!decode) {
+        printf("Error allocating texture");
+        *idx_out = -1;
         return;
     }
+    decode->filepath = get_filepath(path, line_in, len);
+    decode->tex_idx = *idx_out;
+
+    if (texs_out->decode_span == texs_out->decode_length) {
+        texs_out->decode_length =
+            texs_out->decode_length ? texs_out->decode_length * 2 : 8;
+        texs_out->decodes =
+            realloc(texs_out->decodes,
+                    sizeof(*texs_out->decodes) * texs_out->decode_length);
+        assert(texs_out->decodes);
+    }
+    texs_out->decodes[texs_out->decode_span++] = decode;
 
-    stbi_set_flip_vertically_on_load(true);
-    tex_t *new_tex = malloc(sizeof(*new_tex));
-    if (!new_tex) printf("Error allocating texture");
-    new_tex->name = tex_filename;
-    new_tex->data = stbi_load(tex_filepath, &x, &y, &n, 4);
-    new_tex->n = n;
-    new_tex->w = x;
-    new_tex->h = y;
+    tex_t new_tex = {.name = strndup(line_in, len), .filter = filter};
+    append_tex_al(txts_out, &new_tex);
 
-    free(tex_filepath);
+    if (texs_out->pool)
+        submit_job(texs_out->pool, decode_tex, decode);
+    else
+        decode_tex(decode);
+}
 
-    append_tex_al(txts_out, new_tex);
-    free(new_tex);
+// Waits for every decode and fills in the textures and their mip chains. A
+// material whose texture failed to decode ends up without one.
+static void finish_textures(tex_loader_t *texs, mtl_arraylist_t *mtls) {
+    if (texs->pool) wait_thread_pool(texs->pool);
+
+    for (unsigned int i = 0; i < texs->decode_span; i++) {
+        tex_decode_t *decode = texs->decodes[i];
+        tex_t *tex = &texs->list.list[decode->tex_idx];
+        if (!decode->built) {
+            printf("could not load texture: %s\n", decode->filepath);
+            stbi_image_free(decode->tex.data);
+        } else {
+            tex->data = decode->tex.data;
+            tex->n = decode->tex.n;
+            tex->w = decode->tex.w;
+            tex->h = decode->tex.h;
+            tex->levels = decode->tex.levels;
+            tex->level_count = decode->tex.level_count;
+            tex->min_alpha = decode->tex.min_alpha;
+        }
+        free(decode->filepath);
+        free(decode);
+    }
+    free(texs->decodes);
+
+    for (unsigned int i = 0; i < mtls->span; i++) {
+        unsigned int *tex_idxs[3] = {&mtls->list[i].ambient_tex_idx,
+                                     &mtls->list[i].diffuse_tex_idx,
+                                     &mtls->list[i].specular_tex_idx};
+        for (int j = 0; j < 3; j++) {
+            if (*tex_idxs[j] != -1 && !texs->list.list[*tex_idxs[j]].data)
+                *tex_idxs[j] = -1;
+        }
+    }
 }
 
-LINE_CODE get_line_code(char *line) {
+static const struct {
+    const char *keyword;
+    LINE_CODE code;
+} keywords[] = {
+    // .obj file line codes, v, vn, vt and f are matched before the table
+    {"o", OBJECT},
+    {"g", GROUP},
+    {"mtllib", MTL_LIB},
+    {"usemtl", USE_MTL},
+    // .mtl file line codes
+    {"newmtl", NEW_MTL},
+    {"Ka", KA},
+    {"Kd", KD},
+    {"Ks", KS},
+    {"Ns", NS},
+    {"d", D},
+    {"Ni", NI},
+    {"illum", ILLUM},
+    {"map_Ka", MAP_KA},
+    {"map_Kd", MAP_KD},
+    {"map_Ks", MAP_KS},
+};
+
+// line runs up to end, without the line break. args_out is set to the first
+// character after the keyword
+LINE_CODE get_line_code(const char *line, const char *end,
+                        const char **args_out) {
     assert(line);
-    while (line[0] != '\0' && (line[0] == '\n' || line[0] == '\r' ||
-                               line[0] == '\t' || line[0] == ' '))
-        line++;
+    line = skip_blanks(line, end);
 
-    if (line[0] == '\0') return EMPTY;
+    if (line == end) return EMPTY;
     if (line[0] == '#') return COMMENT;
 
-    // .obj file line codes
-    if (!strncmp(line, "v ", 2)) return VERTEX;
-    if (!strncmp(line, "vn ", 3)) return VERTEX_NORMAL;
-    if (!strncmp(line, "vt ", 3)) return VERTEX_TEX;
-
-    if (!strncmp(line, "o ", 2)) return OBJECT;
-    if (!strncmp(line, "g ", 2)) return GROUP;
-
-    if (!strncmp(line, "f ", 2)) return FACE;
-
-    if (!strncmp(line, "mtllib ", 7)) return MTL_LIB;
-    if (!strncmp(line, "usemtl ", 7)) return USE_MTL;
-
-    // .mtl file line codes
-    if (!strncmp(line, "newmtl ", 7)) return NEW_MTL;
+    int len = 0;
+    while (&line[len] < end && !is_blank(line[len])) len++;
+    // every keyword is followed by its arguments
+    if (&line[len] == end) return NULL_CODE;
+    *args_out = &line[len];
+
+    // the bulk of any .obj, checked without going through the table
+    if (line[0] == 'v') {
+        if (len == 1) return VERTEX;
+        if (len == 2 && line[1] == 'n') return VERTEX_NORMAL;
+        if (len == 2 && line[1] == 't') return VERTEX_TEX;
+    }
+    if (line[0] == 'f' && len == 1) return FACE;
 
-    if (!strncmp(line, "Ka ", 3)) return KA;
-    if (!strncmp(line, "Kd ", 3)) return KD;
-    if (!strncmp(line, "Ks ", 3)) return KS;
+    for (int i = 0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+        if (strlen(keywords[i].keyword) == len &&
+            strncmp(line, keywords[i].keyword, len) == 0)
+            return keywords[i].code;
+    }
 
-    if (!strncmp(line, "Ns ", 3)) return NS;
-    if (!strncmp(line, "d ", 2)) return D;
-    if (!strncmp(line, "Ni ", 3)) return NI;
-    if (!strncmp(line, "illum ", 6)) return ILLUM;
+    return NULL_CODE;
+}
 
-    if (!strncmp(line, "map_Ka ", 7)) return MAP_KA;
-    if (!strncmp(line, "map_Kd ", 7)) return MAP_KD;
-    if (!strncmp(line, "map_Ks ", 7)) return MAP_KS;
+// Calls the body once per line of the file with line pointing at its first
+// character and line_end past its last, the \n and a trailing \r excluded
+#define for_each_line(file, line, line_end)                                    \
+    for (const char *line = (file)->data, *line_end = NULL,                    \
+                    *file_end_ = (file)->data + (file)->size;                  \
+         line < file_end_ &&                                                   \
+         (line_end = next_line_end(line, file_end_), true);                    \
+         line = line_end + 1 + (line_end < file_end_ && *line_end == '\r'))
+
+static const char *next_line_end(const char *line, const char *end) {
+    const char *line_end = memchr(line, '\n', end - line);
+    if (!line_end) line_end = end;
+    if (line_end > line && line_end[-1] == '\r') line_end--;
+    return line_end;
+}
 
-    return NULL_CODE;
+// Rest of the line with the surrounding blanks trimmed, for names that can
+// contain spaces
+static int trimmed_len(const char **name, const char *end) {
+    *name = skip_blanks(*name, end);
+    int len = end - *name;
+    while (len > 0 && is_blank((*name)[len - 1])) len--;
+    return len;
 }
 
-int load_mtls(mtl_arraylist_t *mtls_out, tex_arraylist_t *texs_out,
-              char *mtllib_in, const char *path) {
+int load_mtls(mtl_arraylist_t *mtls_out, tex_loader_t *texs_out,
+              const char *mtllib_in, int mtllib_len, const char *path) {
     assert(mtllib_in);
 
-    FILE *mtlfp;
-    char *mtllib_path = get_filepath(path, mtllib_in);
-    mtlfp = fopen(mtllib_path, "r+");
-    if (!mtlfp) {
+    mapped_file_t file;
+    char *mtllib_path = get_filepath(path, mtllib_in, mtllib_len);
+    if (!map_file(&file, mtllib_path)) {
         printf("Error opening file: %s\n", mtllib_path);
         free(mtllib_path);
         return 0;
@@ -190,66 +571,67 @@ int load_mtls(mtl_arraylist_t *mtls_out, tex_arraylist_t *texs_out,
 
     mtl_t *current_mtl = NULL;
 
-    char line[BUFFER_SIZE];
-    while (fgets(line, BUFFER_SIZE, mtlfp) != NULL) {
-        LINE_CODE code = get_line_code(line);
+    for_each_line(&file, line, line_end) {
+        const char *args = NULL;
+        LINE_CODE code = get_line_code(line, line_end, &args);
+        if (code != NEW_MTL && code > COMMENT && current_mtl == NULL) continue;
+
         switch (code) {
         case NULL_CODE:
         case EMPTY:
         case COMMENT:
             break;
 
-        case NEW_MTL:
+        case NEW_MTL: {
             if (current_mtl != NULL)
                 append_mtl_al(mtls_out, current_mtl);
             else
                 current_mtl = malloc(sizeof(*current_mtl));
-            char *name = &line[7];
-            int i = 0;
-            while (name[i] != '\0' && name[i] != '\n' && name[i] != '\r') i++;
-            name[i] = '\0';
-            current_mtl->name = strdup(name);
-            current_mtl->ambient_tex_idx = -1;
-            current_mtl->diffuse_tex_idx = -1;
-            current_mtl->specular_tex_idx = -1;
-            break;
+            int len = trimmed_len(&args, line_end);
+            *current_mtl = (mtl_t){
+                .name = strndup(args, len),
+                .ambient_tex_idx = -1,
+                .diffuse_tex_idx = -1,
+                .specular_tex_idx = -1,
+            };
+        } break;
 
         case KA:
-            parse_triple_float(current_mtl->ambient, &line[3]);
+            parse_triple_float(current_mtl->ambient, args, line_end);
             break;
         case KD:
-            parse_triple_float(current_mtl->diffuse, &line[3]);
+            parse_triple_float(current_mtl->diffuse, args, line_end);
             break;
         case KS:
-            parse_triple_float(current_mtl->specular, &line[3]);
+            parse_triple_float(current_mtl->specular, args, line_end);
             break;
 
         case NS:
-            parse_single_float(&current_mtl->specular_exp, &line[3]);
+            parse_single_float(&current_mtl->specular_exp, args, line_end);
             break;
         case D:
-            parse_single_float(&current_mtl->dissolved, &line[2]);
+            parse_single_float(&current_mtl->dissolved, args, line_end);
             break;
         case NI:
-            parse_single_float(&current_mtl->optical_density, &line[3]);
+            parse_single_float(&current_mtl->optical_density, args, line_end);
             break;
         case ILLUM:
-            parse_single_float(&current_mtl->illum, &line[6]);
+            parse_single_float(&current_mtl->illum, args, line_end);
             break;
 
         case MAP_KA: {
             unsigned int idx;
-            load_tex(&idx, texs_out, &line[7], path);
+            load_tex(&idx, texs_out, args, line_end, path);
             current_mtl->ambient_tex_idx = (unsigned int)idx;
         } break;
         case MAP_KD: {
             unsigned int idx;
-            load_tex(&idx, texs_out, &line[7], path);
+            load_tex(&idx, texs_out, args, line_end, path);
             current_mtl->diffuse_tex_idx = (unsigned int)idx;
         } break;
         case MAP_KS: {
             unsigned int idx;
-            load_tex(&idx, texs_out, &line[7], path);
+            load_tex(&idx, texs_out, args, line_end, path);
             current_mtl->specular_tex_idx = (unsigned int)idx;
         } break;
         default:
@@ -262,175 +644,172 @@ int load_mtls(mtl_arraylist_t *mtls_out, tex_arraylist_t *texs_out,
         free(current_mtl);
     }
 
-    fclose(mtlfp);
+    unmap_file(&file);
 
     return 1;
 }
 
-void set_mtl(mesh_t *mesh_out, mtl_t *mtls_in, int mtls_count, char *line_in) {
+void set_mtl(mesh_t *mesh_out, mtl_t *mtls_in, int mtls_count,
+             const char *line_in, const char *end) {
     assert(mesh_out);
     assert(mtls_in);
     assert(line_in);
 
-    char *mtl_name = line_in;
-    int len = 0;
-    while (mtl_name[len] && mtl_name[len] != '\n' && mtl_name[len] != '\r')
-        len++;
-    mtl_name[len] = '\0';
+    const char *mtl_name = line_in;
+    int len = trimmed_len(&mtl_name, end);
 
     int i;
     for (i = 0; i < mtls_count; i++) {
-        if (strcmp(mtls_in[i].name, mtl_name) == 0) break;
+        if (strlen(mtls_in[i].name) == len &&
+            strncmp(mtls_in[i].name, mtl_name, len) == 0)
+            break;
     }
     mtls_in = i == mtls_count ? NULL : &mtls_in[i];
 
     if (mtls_in)
         mesh_out->mtl = mtls_in;
     else
-        printf("Could not find mtl with name: %s", line_in);
+        printf("Could not find mtl with name: %.*s\n", len, mtl_name);
 }
 
-void load_v(vec3_arraylist_t *vectors_out, char *line_in) {
+void load_v(vec3_arraylist_t *vectors_out, const char *line_in,
+            const char *end) {
     assert(vectors_out);
     assert(line_in);
     vec3_t vec = {0, 0, 1};
-    char *token = strtok(line_in, " ");
-    if (!token) goto end_load_v;
-    vec.x = atof(token);
-    token = strtok(NULL, " ");
-    if (!token) goto end_load_v;
-    vec.y = atof(token);
-    token = strtok(NULL, " ");
-    if (!token) goto end_load_v;
-    vec.z = atof(token);
-end_load_v:
+    float *components[3] = {&vec.x, &vec.y, &vec.z};
+    for (int i = 0; i < 3 && line_in; i++)
+        line_in = parse_float(skip_blanks(line_in, end), end, components[i]);
     append_vec3_al(vectors_out, vec);
 }
 
 typedef struct {
-    uint_arraylist_t *v_indices;
-    uint_arraylist_t *t_indices;
-    uint_arraylist_t *n_indices;
+    uint_arraylist_t v_indices;
+    uint_arraylist_t t_indices;
+    uint_arraylist_t n_indices;
 } indices_t;
 
-int atoi_n(char *str, unsigned int n) {
-    assert(str);
-    if (n == 0) return -1;
-
-    int i = 0;
-    int res = 0;
-    while (i < n) {
-        if (!str[i] || str[i] < '0' || str[i] > '9') return -1;
-        res *= 10;
-        res += str[i] - '0';
-        i++;
+// mtllib and usemtl lines, replayed in file order once every chunk is parsed
+typedef struct {
+    LINE_CODE code;
+    const char *args;
+    const char *end;
+    // triangles of the chunk read before the line
+    unsigned int triangle;
+} obj_event_t;
+
+// A run of whole lines of the .obj parsed on its own. Vertices and indices
+// land in the chunk's own lists and are stitched into the model afterwards.
+typedef struct {
+    mapped_file_t text;
+
+    // vertices, tex_coords and normals in the same order as the .obj tags
+    // v, vt and vn. bases holds how many of each the previous chunks read,
+    // only known after the first pass.
+    vec3_arraylist_t vec3_als[3];
+    unsigned int bases[3];
+
+    indices_t indices;
+    unsigned int triangle_count;
+
+    obj_event_t *events;
+    unsigned int event_span;
+    unsigned int event_length;
+
+    // some face used a negative index, which can only be resolved once bases
+    // is known
+    bool has_relative;
+
+    // corners of faces too big for load_face's stack buffer
+    unsigned int *scratch;
+    unsigned int scratch_length;
+} obj_chunk_t;
+
+// Faces with more corners than this use the chunk's scratch buffer
+#define FACE_CORNERS 16
+
+// Chunks smaller than this are not worth a job
+#define MIN_CHUNK_SIZE 0x10000
+#define MAX_CHUNKS (MAX_THREADS * 2)
+
+// Resolves a 1-based .obj index, negative ones count back from the last
+// element read so far. Missing or zero indices come out as -1
+static unsigned int resolve_index(obj_chunk_t *chunk, int index, int kind) {
+    if (index > 0) return index - 1;
+    if (index < 0) {
+        chunk->has_relative = true;
+        return chunk->bases[kind] + chunk->vec3_als[kind].span + index;
     }
-    return res;
-}
-
-void set_mesh_indices(mesh_t *mesh_out, indices_t *indices_in) {
-    unsigned int *v_indices =
-        malloc(sizeof(*v_indices) * indices_in->v_indices->span);
-    unsigned int *n_indices =
-        malloc(sizeof(*n_indices) * indices_in->n_indices->span);
-    unsigned int *t_indices =
-        malloc(sizeof(*t_indices) * indices_in->t_indices->span);
-
-    memcpy(v_indices, indices_in->v_indices->list,
-           sizeof(*indices_in->v_indices->list) * indices_in->v_indices->span);
-    memcpy(n_indices, indices_in->n_indices->list,
-           sizeof(*indices_in->n_indices->list) * indices_in->n_indices->span);
-    memcpy(t_indices, indices_in->t_indices->list,
-           sizeof(*indices_in->t_indices->list) * indices_in->t_indices->span);
-
-    mesh_out->v_indices = v_indices;
-    mesh_out->n_indices = n_indices;
-    mesh_out->t_indices = t_indices;
-}
-
-void reset_indices(indices_t *indices_out) {
-    free(indices_out->v_indices->list);
-    free(indices_out->n_indices->list);
-    free(indices_out->t_indices->list);
-    init_uint_al(indices_out->v_indices, INDEX_START_SIZE);
-    init_uint_al(indices_out->n_indices, INDEX_START_SIZE);
-    init_uint_al(indices_out->t_indices, INDEX_START_SIZE);
+    return -1;
 }
 
 void load_index(unsigned int *v_out, unsigned int *n_out, unsigned int *t_out,
-                char **index_in) {
+                const char **index_in, const char *end, obj_chunk_t *chunk) {
     assert(v_out);
     assert(n_out);
     assert(t_out);
     assert(index_in);
 
-    while (*index_in && (*index_in[0] == ' ' || *index_in[0] == '\t'))
-        (*index_in)++;
+    const char *c = skip_blanks(*index_in, end);
+
+    // v, v/t, v//n or v/t/n
+    int v = 0, t = 0, n = 0;
+    const char *next = parse_int(c, end, &v);
+    c = next ? next : c;
+    if (c < end && *c == '/') {
+        c++;
+        next = parse_int(c, end, &t);
+        c = next ? next : c;
+        if (c < end && *c == '/') {
+            c++;
+            next = parse_int(c, end, &n);
+            c = next ? next : c;
+        }
+    }
+    // skip whatever is left of a malformed index so the face loop advances
+    while (c < end && !is_blank(*c)) c++;
 
-    *v_out = -1;
-    *n_out = -1;
-    *t_out = -1;
+    *v_out = resolve_index(chunk, v, 0);
+    *t_out = resolve_index(chunk, t, 1);
+    *n_out = resolve_index(chunk, n, 2);
+    *index_in = c;
+}
 
-    int len = 0;
-    while ((*index_in)[len] != '\0' && (*index_in)[len] != '/' &&
-           (*index_in)[len] != ' ' && (*index_in)[len] != '\n' &&
-           (*index_in)[len] != '\r')
-        len++;
-    *v_out = atoi_n(*index_in, len) - 1;
-
-    char index_char = (*index_in)[len];
-    *index_in = (*index_in)[len] ? &(*index_in)[len + 1] : &(*index_in)[len];
-    if (index_char != '/') return;
-
-    len = 0;
-    while ((*index_in)[len] != '\0' && (*index_in)[len] != '/' &&
-           (*index_in)[len] != ' ' && (*index_in)[len] != '\n' &&
-           (*index_in)[len] != '\r')
-        len++;
-    *t_out = atoi_n(*index_in, len) - 1;
-
-    index_char = (*index_in)[len];
-    *index_in = (*index_in)[len] ? &(*index_in)[len + 1] : &(*index_in)[len];
-    if (index_char != '/') return;
-
-    len = 0;
-    while ((*index_in)[len] != '\0' && (*index_in)[len] != '/' &&
-           (*index_in)[len] != ' ' && (*index_in)[len] != '\n' &&
-           (*index_in)[len] != '\r')
-        len++;
-    *n_out = atoi_n(*index_in, len) - 1;
-
-    *index_in = &(*index_in)[len];
-}
-
-void load_face(indices_t *indices_out, unsigned int *face_counter_out,
-               char *line_in) {
-    assert(indices_out);
-    assert(face_counter_out);
+void load_face(obj_chunk_t *chunk, const char *line_in, const char *end) {
+    assert(chunk);
     assert(line_in);
 
-    uint_arraylist_t *vectors = malloc(sizeof(*vectors));
-    assert(vectors);
-    init_uint_al(vectors, 10);
-    uint_arraylist_t *normals = malloc(sizeof(*normals));
-    assert(normals);
-    init_uint_al(normals, 10);
-    uint_arraylist_t *tex_coords = malloc(sizeof(*tex_coords));
-    assert(tex_coords);
-    init_uint_al(tex_coords, 10);
-
-    unsigned int v;
-    unsigned int n;
-    unsigned int t;
+    indices_t *indices_out = &chunk->indices;
+
+    // v, t and n of every corner. Faces up to FACE_CORNERS corners stay on
+    // the stack, bigger ones move to the chunk's scratch buffer, which is
+    // kept for the next big face
+    unsigned int stack_corners[FACE_CORNERS * 3];
+    unsigned int *corners = stack_corners;
+    unsigned int capacity = FACE_CORNERS;
+    unsigned int count = 0;
+
+    while ((line_in = skip_blanks(line_in, end)) < end) {
+        if (count == capacity) {
+            if (chunk->scratch_length < capacity * 2) {
+                unsigned int *scratch =
+                    realloc(chunk->scratch, sizeof(*scratch) * capacity * 6);
+                assert(scratch);
+                chunk->scratch = scratch;
+                chunk->scratch_length = capacity * 2;
+            }
+            if (corners == stack_corners)
+                memcpy(chunk->scratch, stack_corners, sizeof(stack_corners));
+            corners = chunk->scratch;
+            capacity = chunk->scratch_length;
+        }
 
-    while (line_in[0] != '\0' && line_in[0] != '\n' && line_in[0] != '\r') {
-        load_index(&v, &n, &t, &line_in);
-        append_uint_al(vectors, v);
-        append_uint_al(normals, n);
-        append_uint_al(tex_coords, t);
+        unsigned int *corner = &corners[count * 3];
+        load_index(&corner[0], &corner[2], &corner[1], &line_in, end, chunk);
+        count++;
     }
 
-    for (int i = 0; i < vectors->span - 2; i++) {
+    for (int i = 0; i < (int)count - 2; i++) {
         bool clockwise = false;
         int n = i + 2;
         int m = i + 1;
@@ -439,175 +818,459 @@ void load_face(indices_t *indices_out, unsigned int *face_counter_out,
             m = i + 2;
         }
 
-        cpy_uint_al(indices_out->v_indices,
-                    (unsigned int[3]){vectors->list[0], vectors->list[n],
-                                      vectors->list[m]},
-                    *face_counter_out * 3, 3);
-        cpy_uint_al(indices_out->n_indices,
-                    (unsigned int[3]){normals->list[0], normals->list[n],
-                                      normals->list[m]},
-                    *face_counter_out * 3, 3);
-        cpy_uint_al(indices_out->t_indices,
-                    (unsigned int[3]){tex_coords->list[0], tex_coords->list[n],
-                                      tex_coords->list[m]},
-                    *face_counter_out * 3, 3);
-
-        (*face_counter_out)++;
+        unsigned int at = chunk->triangle_count * 3;
+        cpy_uint_al(&indices_out->v_indices,
+                    (unsigned int[3]){corners[0], corners[n * 3],
+                                      corners[m * 3]},
+                    at, 3);
+        cpy_uint_al(&indices_out->t_indices,
+                    (unsigned int[3]){corners[1], corners[n * 3 + 1],
+                                      corners[m * 3 + 1]},
+                    at, 3);
+        cpy_uint_al(&indices_out->n_indices,
+                    (unsigned int[3]){corners[2], corners[n * 3 + 2],
+                                      corners[m * 3 + 2]},
+                    at, 3);
+
+        chunk->triangle_count++;
     }
-
-    destroy_uint_al(vectors);
-    destroy_uint_al(normals);
-    destroy_uint_al(tex_coords);
 }
 
-bool load_model(const char *path, const char *filename, model_t *model) {
-    FILE *fp;
-    char *filepath = get_filepath(path, filename);
-    fp = fopen(filepath, "r+");
-    if (!fp) {
-        printf("Error opening file: %s\n", filepath);
-        free(filepath);
-        return false;
-    }
-    free(filepath);
-
-    unsigned int face_counter = 0;
-
-    vec3_arraylist_t *vertices;
-    vec3_arraylist_t *tex_coords;
-    vec3_arraylist_t *normals;
-    vec3_arraylist_t *vec3_als = malloc(sizeof(*vertices) * 3);
-    if (vec3_als == NULL) {
-        printf("Error allocating vec3 arrays\n");
-        return false;
+static void add_event(obj_chunk_t *chunk, LINE_CODE code, const char *args,
+                      const char *end) {
+    if (chunk->event_span == chunk->event_length) {
+        chunk->event_length = chunk->event_length ? chunk->event_length * 2 : 8;
+        chunk->events = realloc(chunk->events, sizeof(*chunk->events) *
+                                                   chunk->event_length);
+        assert(chunk->events);
     }
+    chunk->events[chunk->event_span++] = (obj_event_t){
+        .code = code,
+        .args = args,
+        .end = end,
+        .triangle = chunk->triangle_count,
+    };
+}
 
-    vertices = &vec3_als[0];
-    tex_coords = &vec3_als[1];
-    normals = &vec3_als[2];
+static void init_chunk(obj_chunk_t *chunk, const char *start,
+                       const char *end) {
+    // parse_chunk reserves the real sizes
+    *chunk = (obj_chunk_t){.text = {start, end - start}};
+    for (int i = 0; i < 3; i++) init_vec3_al(&chunk->vec3_als[i], 1);
+    init_uint_al(&chunk->indices.v_indices, 1);
+    init_uint_al(&chunk->indices.t_indices, 1);
+    init_uint_al(&chunk->indices.n_indices, 1);
+}
 
-    init_vec3_al(vertices, VEC_START_SIZE);
-    init_vec3_al(tex_coords, VEC_START_SIZE);
-    init_vec3_al(normals, VEC_START_SIZE);
+static void destroy_chunk(obj_chunk_t *chunk) {
+    for (int i = 0; i < 3; i++) free(chunk->vec3_als[i].list);
+    free(chunk->indices.v_indices.list);
+    free(chunk->indices.t_indices.list);
+    free(chunk->indices.n_indices.list);
+    free(chunk->events);
+    free(chunk->scratch);
+}
 
-    /* bool uses_t = false; */
-    /* bool uses_n = false; */
+// Counts the vertices and triangles of the chunk ahead of parsing it, so its
+// lists are sized once instead of doubling as they fill
+static void reserve_chunk(obj_chunk_t *chunk) {
+    unsigned int counts[3] = {0};
+    unsigned int triangles = 0;
 
-    // Do this for every mesh?
-    uint_arraylist_t *indices_ = malloc(sizeof(*indices_) * 3);
-    if (indices_ == NULL) {
-        printf("Error allocating vec3 arrays\n");
-        return false;
+    for_each_line(&chunk->text, line, line_end) {
+        const char *args = NULL;
+        switch (get_line_code(line, line_end, &args)) {
+        case VERTEX:
+            counts[0]++;
+            break;
+        case VERTEX_TEX:
+            counts[1]++;
+            break;
+        case VERTEX_NORMAL:
+            counts[2]++;
+            break;
+        case FACE: {
+            int corners = 0;
+            while ((args = skip_blanks(args, line_end)) < line_end) {
+                while (args < line_end && !is_blank(*args)) args++;
+                corners++;
+            }
+            if (corners > 2) triangles += corners - 2;
+        } break;
+        default:
+            break;
+        }
     }
 
-    indices_t indices = {&indices_[0], &indices_[1], &indices_[2]};
-    uint_arraylist_t *v_indices = &indices_[0];
-    uint_arraylist_t *t_indices = &indices_[1];
-    uint_arraylist_t *n_indices = &indices_[2];
-
-    init_uint_al(v_indices, INDEX_START_SIZE);
-    init_uint_al(t_indices, INDEX_START_SIZE);
-    init_uint_al(n_indices, INDEX_START_SIZE);
-
-    mesh_arraylist_t *meshes = malloc(sizeof(*meshes));
-    init_mesh_al(meshes, MESH_START_SIZE);
-
-    mtl_arraylist_t *mtls = malloc(sizeof(*mtls));
-    init_mtl_al(mtls, MTL_START_SIZE);
-
-    tex_arraylist_t *texs = malloc(sizeof(*texs));
-    init_tex_al(texs, TEX_START_SIZE);
-
-    char line[BUFFER_SIZE];
-
-    mesh_t *current_mesh = malloc(sizeof(*current_mesh));
+    for (int i = 0; i < 3; i++)
+        reserve_vec3_al(&chunk->vec3_als[i], counts[i]);
+    reserve_uint_al(&chunk->indices.v_indices, triangles * 3);
+    reserve_uint_al(&chunk->indices.t_indices, triangles * 3);
+    reserve_uint_al(&chunk->indices.n_indices, triangles * 3);
+}
 
-    /* char *line; */
-    while (fgets(line, BUFFER_SIZE, fp) != NULL) {
-        LINE_CODE code = get_line_code(line);
+static void parse_chunk(void *arg) {
+    obj_chunk_t *chunk = arg;
+    reserve_chunk(chunk);
+
+    for (int i = 0; i < 3; i++) chunk->vec3_als[i].span = 0;
+    chunk->indices.v_indices.span = 0;
+    chunk->indices.t_indices.span = 0;
+    chunk->indices.n_indices.span = 0;
+    chunk->triangle_count = 0;
+    chunk->event_span = 0;
+    chunk->has_relative = false;
+
+    for_each_line(&chunk->text, line, line_end) {
+        const char *args = NULL;
+        LINE_CODE code = get_line_code(line, line_end, &args);
         switch (code) {
-        case NULL_CODE:
-        case EMPTY:
-        case COMMENT:
-            break;
         case MTL_LIB:
-            if (!load_mtls(mtls, texs, &line[7], path)) return false;
-            break;
         case USE_MTL:
-            if (current_mesh->mtl) {
-                set_mesh_indices(current_mesh, &indices);
-                current_mesh->triangle_count = face_counter;
-                append_mesh_al(meshes, current_mesh);
-                reset_indices(&indices);
-                face_counter = 0;
-            }
-            set_mtl(current_mesh, mtls->list, mtls->span, &line[7]);
+            add_event(chunk, code, args, line_end);
             break;
         case OBJECT:
         case GROUP:
             // TODO: OBJECT and GROUP tags
             break;
         case VERTEX:
-            load_v(vertices, &line[2]);
-            break;
-        case VERTEX_NORMAL:
-            load_v(normals, &line[3]);
+            load_v(&chunk->vec3_als[0], args, line_end);
             break;
         case VERTEX_TEX:
-            load_v(tex_coords, &line[3]);
+            load_v(&chunk->vec3_als[1], args, line_end);
+            break;
+        case VERTEX_NORMAL:
+            load_v(&chunk->vec3_als[2], args, line_end);
             break;
         case FACE:
-            load_face(&indices, &face_counter, &line[2]);
+            load_face(chunk, args, line_end);
             break;
         default:
             break;
         }
     }
+}
+
+// Cuts [start, file_end) into about chunk_count pieces, each ending right
+// after a line break. Returns how many chunks were made
+static int split_chunks(obj_chunk_t *chunks, int chunk_count,
+                        const char *start, const char *file_end) {
+    const char *text = start;
+    size_t size = file_end - start;
+
+    int count = 0;
+    for (int i = 1; i <= chunk_count && start < file_end; i++) {
+        const char *end = text + size / chunk_count * i;
+        if (i == chunk_count || end >= file_end) {
+            end = file_end;
+        } else if (end < start) {
+            continue;
+        } else {
+            end = memchr(end, '\n', file_end - end);
+            end = end ? end + 1 : file_end;
+        }
+        init_chunk(&chunks[count++], start, end);
+        start = end;
+    }
+
+    return count;
+}
+
+// Loads the mtllib lines ahead of the first geometry line, so their textures
+// decode on the pool while the chunks are parsed. Returns where the geometry
+// starts or NULL when an mtllib failed to load
+static const char *load_header_mtls(const mapped_file_t *file,
+                                    mtl_arraylist_t *mtls_out,
+                                    tex_loader_t *texs_out, const char *path,
+                                    cache_sources_t *sources_out) {
+    for_each_line(file, line, line_end) {
+        const char *args = NULL;
+        LINE_CODE code = get_line_code(line, line_end, &args);
+        switch (code) {
+        case MTL_LIB: {
+            int len = trimmed_len(&args, line_end);
+            if (!load_mtls(mtls_out, texs_out, args, len, path)) return NULL;
+            add_cache_source(sources_out, get_filepath(path, args, len));
+        } break;
+        case USE_MTL:
+        case VERTEX:
+        case VERTEX_NORMAL:
+        case VERTEX_TEX:
+        case FACE:
+            return line;
+        default:
+            break;
+        }
+    }
 
-    if (face_counter != 0) {
-        set_mesh_indices(current_mesh, &indices);
-        current_mesh->triangle_count = face_counter;
+    return file->data + file->size;
+}
+
+// Copies the triangles [begin, end) of the whole file into the mesh, which may
+// span several chunks
+static void set_mesh_indices(mesh_t *mesh_out, obj_chunk_t *chunks,
+                             const unsigned int *triangle_bases,
+                             unsigned int begin, unsigned int end) {
+    unsigned int count = (end - begin) * 3;
+    mesh_out->triangle_count = end - begin;
+    mesh_out->v_indices = malloc(sizeof(*mesh_out->v_indices) * count);
+    mesh_out->n_indices = malloc(sizeof(*mesh_out->n_indices) * count);
+    mesh_out->t_indices = malloc(sizeof(*mesh_out->t_indices) * count);
+
+    unsigned int copied = 0;
+    for (int i = 0; copied < count; i++) {
+        unsigned int chunk_begin = triangle_bases[i];
+        unsigned int chunk_end = chunk_begin + chunks[i].triangle_count;
+        if (chunk_end <= begin) continue;
+
+        unsigned int from = (begin > chunk_begin ? begin : chunk_begin) * 3;
+        unsigned int to = (end < chunk_end ? end : chunk_end) * 3;
+        unsigned int at = from - chunk_begin * 3;
+        unsigned int len = to - from;
+
+        indices_t *indices = &chunks[i].indices;
+        memcpy(&mesh_out->v_indices[copied], &indices->v_indices.list[at],
+               sizeof(unsigned int) * len);
+        memcpy(&mesh_out->n_indices[copied], &indices->n_indices.list[at],
+               sizeof(unsigned int) * len);
+        memcpy(&mesh_out->t_indices[copied], &indices->t_indices.list[at],
+               sizeof(unsigned int) * len);
+        copied += len;
+    }
+}
+
+// Concatenates one vec3 list of every chunk, NULL when all are empty
+static vec3_t *stitch_vec3s(obj_chunk_t *chunks, int chunk_count, int kind,
+                            unsigned int total) {
+    if (total == 0) return NULL;
+
+    vec3_t *vectors = malloc(sizeof(*vectors) * total);
+    if (!vectors) return NULL;
+
+    unsigned int at = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        vec3_arraylist_t *al = &chunks[i].vec3_als[kind];
+        memcpy(&vectors[at], al->list, sizeof(*vectors) * al->span);
+        at += al->span;
+    }
+    return vectors;
+}
+
+// Parses the .obj and everything it references, sources_out collects those
+// files for the cache
+static bool parse_model(const char *path, const char *filepath,
+                        model_t *model, thread_pool_t *pool,
+                        cache_sources_t *sources_out) {
+    mapped_file_t file;
+    if (!map_file(&file, filepath)) {
+        printf("Error opening file: %s\n", filepath);
+        return false;
+    }
+    add_cache_source(sources_out, strdup(filepath));
+
+    mesh_arraylist_t *meshes = malloc(sizeof(*meshes));
+    init_mesh_al(meshes, MESH_START_SIZE);
+
+    mtl_arraylist_t *mtls = malloc(sizeof(*mtls));
+    init_mtl_al(mtls, MTL_START_SIZE);
+
+    tex_loader_t texs = {.pool = pool};
+    init_tex_al(&texs.list, TEX_START_SIZE);
+    // set once up front, the decode jobs only read it
+    stbi_set_flip_vertically_on_load(true);
+
+    const char *geometry =
+        load_header_mtls(&file, mtls, &texs, path, sources_out);
+    if (!geometry) return false;
+    size_t geometry_size = file.data + file.size - geometry;
+
+    // a couple of chunks per thread evens out chunks that parse slower
+    int chunk_count = pool ? (pool->thread_count + 1) * 2 : 1;
+    if (chunk_count > MAX_CHUNKS) chunk_count = MAX_CHUNKS;
+    if (chunk_count > geometry_size / MIN_CHUNK_SIZE)
+        chunk_count = geometry_size / MIN_CHUNK_SIZE;
+    if (chunk_count < 1) chunk_count = 1;
+
+    obj_chunk_t *chunks = malloc(sizeof(*chunks) * chunk_count);
+    unsigned int *triangle_bases =
+        malloc(sizeof(*triangle_bases) * chunk_count);
+    if (chunks == NULL || triangle_bases == NULL) {
+        printf("Error allocating obj chunks\n");
+        unmap_file(&file);
+        return false;
+    }
+    chunk_count =
+        split_chunks(chunks, chunk_count, geometry, file.data + file.size);
+
+    // the textures queued by the header are already decoding, the chunks
+    // join them on the pool
+    if (pool) {
+        for (int i = 0; i < chunk_count; i++)
+            submit_job(pool, parse_chunk, &chunks[i]);
+        wait_thread_pool(pool);
+    } else {
+        for (int i = 0; i < chunk_count; i++) parse_chunk(&chunks[i]);
+    }
+
+    unsigned int totals[3] = {0};
+    unsigned int triangle_count = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            chunks[i].bases[j] = totals[j];
+            totals[j] += chunks[i].vec3_als[j].span;
+        }
+        // negative indices are rare enough that the chunk is parsed again
+        // now that it knows how many vertices came before it
+        if (chunks[i].has_relative) parse_chunk(&chunks[i]);
+
+        triangle_bases[i] = triangle_count;
+        triangle_count += chunks[i].triangle_count;
+    }
+
+    mesh_t *current_mesh = calloc(1, sizeof(*current_mesh));
+    unsigned int mesh_begin = 0;
+
+    // replay the material lines in order, a usemtl closes the current mesh
+    // once it has a material
+    for (int i = 0; i < chunk_count; i++) {
+        for (unsigned int j = 0; j < chunks[i].event_span; j++) {
+            obj_event_t *event = &chunks[i].events[j];
+            const char *args = event->args;
+
+            if (event->code == MTL_LIB) {
+                int len = trimmed_len(&args, event->end);
+                if (!load_mtls(mtls, &texs, args, len, path)) return false;
+                add_cache_source(sources_out, get_filepath(path, args, len));
+            } else {
+                unsigned int triangle = triangle_bases[i] + event->triangle;
+                if (current_mesh->mtl) {
+                    set_mesh_indices(current_mesh, chunks, triangle_bases,
+                                     mesh_begin, triangle);
+                    append_mesh_al(meshes, current_mesh);
+                    mesh_begin = triangle;
+                }
+                set_mtl(current_mesh, mtls->list, mtls->span, args, event->end);
+            }
+        }
+    }
+
+    if (triangle_count != mesh_begin) {
+        set_mesh_indices(current_mesh, chunks, triangle_bases, mesh_begin,
+                         triangle_count);
         append_mesh_al(meshes, current_mesh);
-        reset_indices(&indices);
     }
 
     model->mesh_count = meshes->span;
     model->meshes = malloc(sizeof(*model->meshes) * meshes->span);
     memcpy(model->meshes, meshes->list, sizeof(*model->meshes) * meshes->span);
 
-    model->vertex_count = vertices->span;
-    model->vertices = malloc(sizeof(*model->vertices) * vertices->span);
-    memcpy(model->vertices, vertices->list,
-           sizeof(*model->vertices) * vertices->span);
+    model->vertex_count = totals[0];
+    model->tex_coord_count = totals[1];
+    model->normal_count = totals[2];
+    model->vertices = stitch_vec3s(chunks, chunk_count, 0, totals[0]);
+    model->tex_coords = stitch_vec3s(chunks, chunk_count, 1, totals[1]);
+    model->normals = stitch_vec3s(chunks, chunk_count, 2, totals[2]);
+
+    // the meshes point into the material list, so the model keeps it as is
+    model->material_count = mtls->span;
+    model->materials = mtls->list;
+
+    finish_textures(&texs, mtls);
+    model->texture_count = texs.list.span;
+    model->textures = texs.list.list;
+    // a texture that failed to load keeps the model from being cached
+    for (unsigned int i = 0; i < texs.list.span; i++) {
+        const char *name = texs.list.list[i].name;
+        add_cache_source(sources_out, get_filepath(path, name, strlen(name)));
+    }
+
+    for (int i = 0; i < chunk_count; i++) destroy_chunk(&chunks[i]);
+    free(chunks);
+    free(triangle_bases);
+
+    destroy_mesh_al(meshes);
+    free(mtls);
+
+    free(current_mesh);
+    unmap_file(&file);
+
+    return true;
+}
 
-    if (normals->span) {
-        model->normals = malloc(sizeof(*model->normals) * normals->span);
-        memcpy(model->normals, normals->list,
-               sizeof(*model->normals) * normals->span);
+static void compute_mesh_bounds(const model_t *model, mesh_t *mesh) {
+    vec3_t min = {0, 0, 0};
+    vec3_t max = {0, 0, 0};
+    int index_count = mesh->triangle_count * 3;
+    for (int i = 0; i < index_count; i++) {
+        const vec3_t *v = &model->vertices[mesh->v_indices[i]];
+        if (i == 0) min = max = *v;
+        min = (vec3_t){fminf(min.x, v->x), fminf(min.y, v->y),
+                       fminf(min.z, v->z)};
+        max = (vec3_t){fmaxf(max.x, v->x), fmaxf(max.y, v->y),
+                       fmaxf(max.z, v->z)};
     }
 
-    if (tex_coords->span) {
-        model->tex_coords =
-            malloc(sizeof(*model->tex_coords) * tex_coords->span);
-        memcpy(model->tex_coords, tex_coords->list,
-               sizeof(*model->tex_coords) * tex_coords->span);
+    mesh->aabb_min = min;
+    mesh->aabb_max = max;
+    mesh->center = (vec3_t){(min.x + max.x) / 2, (min.y + max.y) / 2,
+                            (min.z + max.z) / 2};
+
+    float radius_sq = 0;
+    for (int i = 0; i < index_count; i++) {
+        vec3_t d = vec3_sub(&model->vertices[mesh->v_indices[i]],
+                            &mesh->center);
+        radius_sq = fmaxf(radius_sq, vec3_dot(&d, &d));
     }
+    mesh->radius = sqrtf(radius_sq);
+}
 
-    if (texs->span) {
-        model->textures = malloc(sizeof(*model->textures) * texs->span);
-        memcpy(model->textures, texs->list,
-               sizeof(*model->textures) * texs->span);
+static bool compute_face_planes(const model_t *model, mesh_t *mesh) {
+    mesh->face_planes =
+        malloc(sizeof(vec4_t) * (mesh->triangle_count ? mesh->triangle_count
+                                                      : 1));
+    if (!mesh->face_planes) {
+        fprintf(stderr, "Error allocating face planes.\n");
+        return false;
     }
 
-    free(vec3_als);
+    for (int i = 0; i < mesh->triangle_count; i++) {
+        vec3_t normal = triangle_normal(model, mesh, i);
+        const vec3_t *A = &model->vertices[mesh->v_indices[i * 3]];
+        mesh->face_planes[i] =
+            (vec4_t){normal.x, normal.y, normal.z, -vec3_dot(&normal, A)};
+    }
+    return true;
+}
 
-    free(indices_);
-    free(meshes);
-    free(mtls);
-    free(texs);
+bool load_model(const char *path, const char *filename, model_t *model,
+                thread_pool_t *pool) {
+    char *filepath = get_filepath(path, filename, strlen(filename));
+    model->cache = NULL;
+    model->cache_size = 0;
+
+    bool loaded = load_model_cache(filepath, model);
+    if (!loaded) {
+        cache_sources_t sources;
+        init_cache_sources(&sources);
+        loaded = parse_model(path, filepath, model, pool, &sources) &&
+                 build_model_bvh(model);
+        if (loaded) save_model_cache(filepath, model, &sources);
+        destroy_cache_sources(&sources);
+    }
+    free(filepath);
+    if (!loaded) return false;
 
-    free(current_mesh);
-    fclose(fp);
+    model->view_x = malloc(sizeof(float) * model->vertex_count);
+    model->view_y = malloc(sizeof(float) * model->vertex_count);
+    model->view_z = malloc(sizeof(float) * model->vertex_count);
+    if (!model->view_x || !model->view_y || !model->view_z) {
+        fprintf(stderr, "Error allocating view space vertices.\n");
+        return false;
+    }
 
-    return true;
+    for (int i = 0; i < model->mesh_count; i++) {
+        compute_mesh_bounds(model, &model->meshes[i]);
+        if (!compute_face_planes(model, &model->meshes[i])) return false;
+    }
+    return build_model_meshlets(model);
 }
@@ -2,5 +2,20 @@
 
 #include "../engine.h"
 
-bool load_model(const char *path, const char *filename, model_t *model);
+// Textures are resampled up to power of two sides at load, setting
+// ENGINE_POT_TEXTURES=0 in the environment keeps their own size
+bool load_model(const char *path, const char *filename, model_t *model,
+                thread_pool_t *pool);
 bool load_mesh(const char *filename, const char *sprite_filename, mesh_t *mesh);
+
+// Size of the first mip level of a w x h image, the next powers of two unless
+// ENGINE_POT_TEXTURES=0
+void tex_base_size(unsigned int w, unsigned int h, unsigned int *base_w,
+                   unsigned int *base_h);
+// Bytes of the tiled mip chain halving down from w x h and its level count
+size_t tex_chain_size(unsigned int w, unsigned int h,
+                      unsigned int *level_count);
+// Points the level_count levels of tex, halving down from w x h, into the
+// tiled texels at data, which hold one level after the other
+void lay_out_tex_levels(tex_t *tex, uint8_t *data, unsigned int w,
+                        unsigned int h);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "cpu_dispatch.h"
 #include "engine.h"
 #include "loading/obj_loading.h"
 #include "state.h"
@@ -26,6 +27,9 @@ engine_t *engine = NULL;
 state_t *state = NULL;
 
 bool init(void) {
+    init_cpu_dispatch();
+    printf("SIMD: %s\n", cpu_level_name(cpu_level));
+
     engine_t *engine = malloc(sizeof(engine_t));
     if (!engine) {
         fprintf(stderr, "Error allocating engine in heap.\n");
@@ -55,13 +59,25 @@ bool init(void) {
 
     state->time_tracking.total_time = 0;
 
+    state->culling.backfacing_meshlets = 0;
+    state->culling.backfacing_triangles = 0;
+    state->culling.bvh_nodes = 0;
+    state->culling.bvh_triangles = 0;
+    state->culling.hiz_triangles = 0;
+    state->culling.hiz_pixels = 0;
+
+    state->overdraw.shaded_pixels = 0;
+    state->overdraw.prepass_pixels = 0;
+    state->overdraw.prepass_shaded = 0;
+
     return true;
 }
 
 char *get_gui_text(state_t *state) {
     // FPS
     char *fps_text;
-    asprintf(&fps_text, "FPS: %llu", state->time.fps);
+    asprintf(&fps_text, "FPS: %llu    SIMD: %s", state->time.fps,
+             cpu_level_name(cpu_level));
 
     // CAMERA DIR
     char *camera_pos_text;
@@ -82,11 +98,44 @@ char *get_gui_text(state_t *state) {
              state->time_tracking.mesh_draw_time_percentage,
              state->time_tracking.render_time_percentage);
 
+    // MESHLET AND OCCLUSION CULLING
+    char *culling_text;
+    asprintf(&culling_text,
+             "Backfacing meshlets: %u (%u triangles) \n"
+             "Occluded nodes: %u (%u triangles) \n"
+             "Hi-z rejected:  %u triangles, %u pixels \n",
+             state->culling.backfacing_meshlets,
+             state->culling.backfacing_triangles, state->culling.bvh_nodes,
+             state->culling.bvh_triangles,
+             state->culling.hiz_triangles, state->culling.hiz_pixels);
+
+    // OVERDRAW
+    char *overdraw_text;
+    if (state->flags.depth_prepass) {
+        asprintf(&overdraw_text,
+                 "Shaded pixels:  %u (%.2f per screen pixel) \n"
+                 "Depth pre-pass: on, %d shades saved \n",
+                 state->overdraw.shaded_pixels,
+                 (float)state->overdraw.shaded_pixels /
+                     (SCREEN_WIDTH * SCREEN_HEIGHT),
+                 (int)(state->overdraw.prepass_pixels -
+                       state->overdraw.prepass_shaded));
+    } else {
+        asprintf(&overdraw_text,
+                 "Shaded pixels:  %u (%.2f per screen pixel) \n"
+                 "Depth pre-pass: off \n",
+                 state->overdraw.shaded_pixels,
+                 (float)state->overdraw.shaded_pixels /
+                     (SCREEN_WIDTH * SCREEN_HEIGHT));
+    }
+
     // MAKE GUI TEXT
     char *gui_text;
-    asprintf(&gui_text, "%s\n%s\n%s", fps_text, camera_pos_text,
-             time_debug_text);
+    asprintf(&gui_text, "%s\n%s\n%s\n%s\n%s", fps_text, camera_pos_text,
+             time_debug_text, culling_text, overdraw_text);
 
+    free(overdraw_text);
+    free(culling_text);
     free(time_debug_text);
     free(camera_pos_text);
     free(fps_text);
@@ -139,7 +188,8 @@ int main(int argc, char *argv[]) {
     if (!model) {
         fprintf(stderr, "Error allocating mesh in heap.\n");
     } else {
-        bool loaded = load_model(obj_path, object_name, model);
+        bool loaded = load_model(obj_path, object_name, model,
+                                 state->engine->thread_pool);
         if (!loaded) {
             fprintf(stderr, "Error loading model.\n");
         } else {
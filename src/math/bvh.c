@@ -0,0 +1,267 @@
+#include "bvh.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BVH_BINS 12
+// Nodes this small are never split
+#define BVH_MIN_LEAF 2
+// Nodes up to this size become leaves when no split is cheaper, bigger ones
+// are always split
+#define BVH_MAX_LEAF 8
+// Cost of visiting a node relative to processing one triangle
+#define BVH_TRAVERSAL_COST 1.0f
+
+typedef struct {
+    vec3_t min;
+    vec3_t max;
+} bounds_t;
+
+typedef struct {
+    unsigned int node;
+    int depth;
+} build_task_t;
+
+static bounds_t empty_bounds(void) {
+    return (bounds_t){{INFINITY, INFINITY, INFINITY},
+                      {-INFINITY, -INFINITY, -INFINITY}};
+}
+
+static void grow_bounds(bounds_t *bounds, const vec3_t *min,
+                        const vec3_t *max) {
+    bounds->min = (vec3_t){fminf(bounds->min.x, min->x),
+                           fminf(bounds->min.y, min->y),
+                           fminf(bounds->min.z, min->z)};
+    bounds->max = (vec3_t){fmaxf(bounds->max.x, max->x),
+                           fmaxf(bounds->max.y, max->y),
+                           fmaxf(bounds->max.z, max->z)};
+}
+
+static float surface_area(const bounds_t *bounds) {
+    vec3_t d = vec3_sub(&bounds->max, &bounds->min);
+    if (d.x < 0) return 0;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static float axis_of(const vec3_t *v, int axis) {
+    return axis == 0 ? v->x : axis == 1 ? v->y : v->z;
+}
+
+static int bin_of(float centroid, float min, float extent) {
+    int bin = (centroid - min) * (BVH_BINS / extent);
+    return bin < 0 ? 0 : bin >= BVH_BINS ? BVH_BINS - 1 : bin;
+}
+
+// Picks the cheapest of the BVH_BINS - 1 splits along each axis, returns
+// false when the centroids don't spread along any axis
+static bool find_split(const bounds_t *tri_bounds, const vec3_t *centroids,
+                       const unsigned int *order, unsigned int count,
+                       const bounds_t *centroid_bounds, int *axis_out,
+                       int *bin_out, float *cost_out) {
+    bool found = false;
+    *cost_out = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float min = axis_of(&centroid_bounds->min, axis);
+        float extent = axis_of(&centroid_bounds->max, axis) - min;
+        if (extent <= 0) continue;
+
+        bounds_t bins[BVH_BINS];
+        unsigned int bin_counts[BVH_BINS] = {0};
+        for (int i = 0; i < BVH_BINS; i++) bins[i] = empty_bounds();
+
+        for (unsigned int i = 0; i < count; i++) {
+            const bounds_t *b = &tri_bounds[order[i]];
+            int bin = bin_of(axis_of(&centroids[order[i]], axis), min, extent);
+            grow_bounds(&bins[bin], &b->min, &b->max);
+            bin_counts[bin]++;
+        }
+
+        // areas and counts of everything left of each split, then sweep
+        // back from the right
+        float left_areas[BVH_BINS - 1];
+        unsigned int left_counts[BVH_BINS - 1];
+        bounds_t left = empty_bounds();
+        unsigned int left_count = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            grow_bounds(&left, &bins[i].min, &bins[i].max);
+            left_count += bin_counts[i];
+            left_areas[i] = surface_area(&left);
+            left_counts[i] = left_count;
+        }
+
+        bounds_t right = empty_bounds();
+        unsigned int right_count = 0;
+        for (int i = BVH_BINS - 1; i > 0; i--) {
+            grow_bounds(&right, &bins[i].min, &bins[i].max);
+            right_count += bin_counts[i];
+            if (left_counts[i - 1] == 0 || right_count == 0) continue;
+
+            float cost = left_areas[i - 1] * left_counts[i - 1] +
+                         surface_area(&right) * right_count;
+            if (cost < *cost_out) {
+                *cost_out = cost;
+                *axis_out = axis;
+                *bin_out = i;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+static bool build_mesh_bvh(model_t *model, mesh_t *mesh) {
+    unsigned int triangle_count = mesh->triangle_count;
+    unsigned int alloc_count = triangle_count ? triangle_count : 1;
+
+    bounds_t *tri_bounds = malloc(sizeof(*tri_bounds) * alloc_count);
+    vec3_t *centroids = malloc(sizeof(*centroids) * alloc_count);
+    unsigned int *order = malloc(sizeof(*order) * alloc_count);
+    unsigned int *indices = malloc(sizeof(*indices) * alloc_count * 3);
+    if (!tri_bounds || !centroids || !order || !indices) {
+        free(tri_bounds);
+        free(centroids);
+        free(order);
+        free(indices);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < triangle_count; i++) {
+        tri_bounds[i] = empty_bounds();
+        for (int j = 0; j < 3; j++) {
+            const vec3_t *v = &model->vertices[mesh->v_indices[i * 3 + j]];
+            grow_bounds(&tri_bounds[i], v, v);
+        }
+        centroids[i] = vec3_add(&tri_bounds[i].min, &tri_bounds[i].max);
+        centroids[i] = vec3_mul(&centroids[i], 0.5f);
+        order[i] = i;
+    }
+
+    bvh_node_t *nodes = model->bvh_nodes;
+    mesh->bvh_root = model->bvh_node_count++;
+    nodes[mesh->bvh_root] = (bvh_node_t){.first = 0, .count = triangle_count};
+
+    // a node pops and pushes its two children, so the stack never holds
+    // more than one entry per level plus one
+    build_task_t stack[BVH_MAX_DEPTH + 2];
+    int top = 0;
+    stack[top++] = (build_task_t){mesh->bvh_root, 0};
+
+    while (top > 0) {
+        build_task_t task = stack[--top];
+        bvh_node_t *node = &nodes[task.node];
+        const unsigned int *node_order = &order[node->first];
+
+        bounds_t bounds = empty_bounds();
+        bounds_t centroid_bounds = empty_bounds();
+        for (unsigned int i = 0; i < node->count; i++) {
+            const bounds_t *b = &tri_bounds[node_order[i]];
+            grow_bounds(&bounds, &b->min, &b->max);
+            grow_bounds(&centroid_bounds, &centroids[node_order[i]],
+                        &centroids[node_order[i]]);
+        }
+        node->min = node->count ? bounds.min : (vec3_t){0, 0, 0};
+        node->max = node->count ? bounds.max : (vec3_t){0, 0, 0};
+
+        if (node->count <= BVH_MIN_LEAF || task.depth >= BVH_MAX_DEPTH)
+            continue;
+
+        int axis = 0;
+        int split_bin = 0;
+        float split_cost;
+        bool found = find_split(tri_bounds, centroids, node_order,
+                                node->count, &centroid_bounds, &axis,
+                                &split_bin, &split_cost);
+
+        float leaf_cost = surface_area(&bounds) * node->count;
+        split_cost += surface_area(&bounds) * BVH_TRAVERSAL_COST;
+        if ((!found || split_cost >= leaf_cost) &&
+            node->count <= BVH_MAX_LEAF)
+            continue;
+
+        // partition the node's triangles around the split, a node whose
+        // centroids all coincide is just cut in half
+        unsigned int mid = node->count / 2;
+        if (found) {
+            unsigned int *first = &order[node->first];
+            unsigned int *last = first + node->count;
+            float min = axis_of(&centroid_bounds.min, axis);
+            float extent = axis_of(&centroid_bounds.max, axis) - min;
+            while (first < last) {
+                if (bin_of(axis_of(&centroids[*first], axis), min, extent) <
+                    split_bin) {
+                    first++;
+                } else {
+                    unsigned int tmp = *first;
+                    *first = *--last;
+                    *last = tmp;
+                }
+            }
+            mid = first - &order[node->first];
+            if (mid == 0 || mid == node->count) mid = node->count / 2;
+        }
+
+        node->left = model->bvh_node_count;
+        model->bvh_node_count += 2;
+        nodes[node->left] = (bvh_node_t){.first = node->first, .count = mid};
+        nodes[node->left + 1] = (bvh_node_t){
+            .first = node->first + mid,
+            .count = node->count - mid,
+        };
+        stack[top++] = (build_task_t){node->left + 1, task.depth + 1};
+        stack[top++] = (build_task_t){node->left, task.depth + 1};
+    }
+
+    // reorder the triangles so every node's range is contiguous
+    unsigned int *mesh_indices[3] = {mesh->v_indices, mesh->t_indices,
+                                     mesh->n_indices};
+    for (int k = 0; k < 3; k++) {
+        for (unsigned int i = 0; i < triangle_count; i++) {
+            indices[i * 3 + 0] = mesh_indices[k][order[i] * 3 + 0];
+            indices[i * 3 + 1] = mesh_indices[k][order[i] * 3 + 1];
+            indices[i * 3 + 2] = mesh_indices[k][order[i] * 3 + 2];
+        }
+        memcpy(mesh_indices[k], indices,
+               sizeof(*indices) * triangle_count * 3);
+    }
+
+    free(tri_bounds);
+    free(centroids);
+    free(order);
+    free(indices);
+
+    return true;
+}
+
+bool build_model_bvh(model_t *model) {
+    // a binary tree with at least one triangle per leaf has fewer than twice
+    // as many nodes as triangles
+    size_t max_nodes = 0;
+    for (int i = 0; i < model->mesh_count; i++) {
+        int triangle_count = model->meshes[i].triangle_count;
+        max_nodes += triangle_count > 0 ? triangle_count * 2 - 1 : 1;
+    }
+
+    model->bvh_node_count = 0;
+    model->bvh_nodes = malloc(sizeof(bvh_node_t) * (max_nodes + 1));
+    if (!model->bvh_nodes) {
+        fprintf(stderr, "Error allocating bvh nodes.\n");
+        return false;
+    }
+
+    for (int i = 0; i < model->mesh_count; i++) {
+        if (!build_mesh_bvh(model, &model->meshes[i])) {
+            fprintf(stderr, "Error building mesh bvh.\n");
+            return false;
+        }
+    }
+
+    size_t size = sizeof(bvh_node_t) * (model->bvh_node_count + 1);
+    bvh_node_t *nodes = realloc(model->bvh_nodes, size);
+    if (nodes) model->bvh_nodes = nodes;
+
+    return true;
+}
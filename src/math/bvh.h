@@ -0,0 +1,15 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "../engine.h"
+
+// Deeper nodes are made leaves whatever their size, so a traversal stack of
+// BVH_MAX_DEPTH + 2 entries never overflows
+#define BVH_MAX_DEPTH 48
+
+// Builds a binned SAH bvh over the triangles of every mesh of the model into
+// model->bvh_nodes. The index arrays of each mesh are reordered so every node
+// covers a contiguous range of its triangles.
+bool build_model_bvh(model_t *model);
+
+#endif // !BVH_H
@@ -148,3 +148,39 @@ matrix_t rotation_matrix_from_axis(const vec3_t *axis, float angle) {
 
     return R_u;
 }
+
+vec3_t triangle_normal(const model_t *model, const mesh_t *mesh,
+                       unsigned int triangle_id) {
+    const vec3_t *A = &model->vertices[mesh->v_indices[triangle_id * 3 + 0]];
+    const vec3_t *B = &model->vertices[mesh->v_indices[triangle_id * 3 + 1]];
+    const vec3_t *C = &model->vertices[mesh->v_indices[triangle_id * 3 + 2]];
+
+    vec3_t face_normal;
+    vec3_t AB = vec3_sub(B, A);
+    vec3_t AC = vec3_sub(C, A);
+    if (model->normals != NULL) {
+        unsigned int A_norm_index = mesh->n_indices[triangle_id * 3 + 0];
+        unsigned int B_norm_index = mesh->n_indices[triangle_id * 3 + 1];
+        unsigned int C_norm_index = mesh->n_indices[triangle_id * 3 + 2];
+
+        if (A_norm_index == -1 || B_norm_index == -1 || C_norm_index == -1) {
+            face_normal = vec3_cross(&AC, &AB);
+            face_normal = vec3_norm(&face_normal);
+        } else {
+            vec3_t A_n = model->normals[A_norm_index];
+            vec3_t B_n = model->normals[B_norm_index];
+            vec3_t C_n = model->normals[C_norm_index];
+            face_normal = (vec3_t){
+                A_n.x + B_n.x + C_n.x,
+                A_n.y + B_n.y + C_n.y,
+                A_n.z + B_n.z + C_n.z,
+            };
+            face_normal = vec3_norm(&face_normal);
+        }
+    } else {
+        face_normal = vec3_cross(&AB, &AC);
+        face_normal = vec3_norm(&face_normal);
+    }
+
+    return face_normal;
+}
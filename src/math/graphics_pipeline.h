@@ -20,4 +20,9 @@ generate_rotation_matrix(float x_rotation, float y_rotation, float z_rotation);
 
 matrix_t rotation_matrix_from_axis(const vec3_t *axis, float angle);
 
+// Model space normal a triangle is shaded and backface culled with, the
+// average of its vertex normals when it has them
+vec3_t triangle_normal(const model_t *model, const mesh_t *mesh,
+                       unsigned int triangle_id);
+
 #endif // !GRAPHICS_PIPELINE_H
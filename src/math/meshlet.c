@@ -0,0 +1,161 @@
+#include "meshlet.h"
+#include "bvh.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Widens every cone a little so normals rounded differently in view space
+// never make a drawn triangle's meshlet face away
+#define CONE_SLACK 1e-3f
+// Cost of testing a meshlet, in triangles it would have to cull to pay off
+#define MESHLET_TEST_COST 1.0f
+
+static void build_meshlet(const model_t *model, const mesh_t *mesh,
+                          const bvh_node_t *node, meshlet_t *meshlet) {
+    vec3_t center = vec3_add(&node->min, &node->max);
+    center = vec3_mul(&center, 0.5f);
+
+    float radius_sq = 0;
+    vec3_t axis = {0, 0, 0};
+    bool finite = true;
+    for (unsigned int i = node->first; i < node->first + node->count; i++) {
+        for (int j = 0; j < 3; j++) {
+            vec3_t d = vec3_sub(&model->vertices[mesh->v_indices[i * 3 + j]],
+                                &center);
+            radius_sq = fmaxf(radius_sq, vec3_dot(&d, &d));
+        }
+
+        const vec4_t *plane = &mesh->face_planes[i];
+        vec3_t normal = {plane->x, plane->y, plane->z};
+        // a degenerate triangle's nan normal never passes the backface test,
+        // so its meshlet can't be culled as a whole
+        finite = finite && isfinite(normal.x) && isfinite(normal.y) &&
+                 isfinite(normal.z);
+        axis = vec3_add(&axis, &normal);
+    }
+
+    meshlet->center = center;
+    meshlet->radius = sqrtf(radius_sq);
+    meshlet->cone_axis = (vec3_t){0, 0, 0};
+    meshlet->cone_cos = 0;
+    meshlet->cone_sin = 1;
+    meshlet->cone_offset = 0;
+    if (!finite || vec3_dot(&axis, &axis) == 0) return;
+
+    axis = vec3_norm(&axis);
+    float min_dot = 1;
+    float max_offset = -INFINITY;
+    for (unsigned int i = node->first; i < node->first + node->count; i++) {
+        const vec4_t *plane = &mesh->face_planes[i];
+        vec3_t normal = {plane->x, plane->y, plane->z};
+        min_dot = fminf(min_dot, vec3_dot(&normal, &axis));
+        // how far the plane lies in front of the center
+        max_offset = fmaxf(max_offset, -distance_to_plane(plane, &center));
+    }
+
+    // normals more than 90 degrees apart can't face away together
+    float cone_cos = fminf(min_dot, 1) - CONE_SLACK;
+    if (cone_cos <= 0) return;
+
+    meshlet->cone_axis = axis;
+    meshlet->cone_cos = cone_cos;
+    meshlet->cone_sin = sqrtf(1 - cone_cos * cone_cos);
+    meshlet->cone_offset = max_offset + meshlet->radius * CONE_SLACK;
+}
+
+// Triangles a meshlet is expected to cull minus the cost of testing it, in
+// triangles. Seen from a random direction a cone of half angle a faces away
+// with a chance of (1 - sin a) / 2
+static float meshlet_value(const meshlet_t *meshlet, unsigned int count) {
+    float chance = meshlet->cone_cos > 0 ? (1 - meshlet->cone_sin) / 2 : 0;
+    return count * chance - MESHLET_TEST_COST;
+}
+
+bool build_model_meshlets(model_t *model) {
+    size_t node_count = model->bvh_node_count + 1;
+    model->meshlet_count = 0;
+    model->meshlets = malloc(sizeof(meshlet_t) * node_count);
+    model->node_meshlets = malloc(sizeof(unsigned int) * node_count);
+    meshlet_t *candidates = malloc(sizeof(meshlet_t) * node_count);
+    float *values = malloc(sizeof(float) * node_count);
+    if (!model->meshlets || !model->node_meshlets || !candidates || !values) {
+        fprintf(stderr, "Error allocating meshlets.\n");
+        free(candidates);
+        free(values);
+        return false;
+    }
+
+    // every small enough node gets its bounds and the best value of the
+    // meshlets it could be split into, children come after their parent so
+    // walking backwards sees them first. A node left without a meshlet is
+    // drawn untested, which is worth 0
+    for (int i = 0; i < model->mesh_count; i++) {
+        const mesh_t *mesh = &model->meshes[i];
+        unsigned int root = mesh->bvh_root;
+        unsigned int end = i + 1 < model->mesh_count
+                               ? model->meshes[i + 1].bvh_root
+                               : (unsigned int)model->bvh_node_count;
+        for (unsigned int j = end; j-- > root;) {
+            const bvh_node_t *node = &model->bvh_nodes[j];
+            if (node->count > MESHLET_TRIANGLES && node->left) continue;
+
+            build_meshlet(model, mesh, node, &candidates[j]);
+            values[j] = fmaxf(meshlet_value(&candidates[j], node->count), 0);
+            if (node->left) {
+                values[j] = fmaxf(values[j], values[node->left] +
+                                                 values[node->left + 1]);
+            }
+        }
+    }
+
+    // then pick them top down
+    for (int i = 0; i < model->bvh_node_count; i++)
+        model->node_meshlets[i] = NO_MESHLET;
+    for (int i = 0; i < model->mesh_count; i++) {
+        unsigned int stack[BVH_MAX_DEPTH + 2];
+        int top = 0;
+        stack[top++] = model->meshes[i].bvh_root;
+        while (top > 0) {
+            unsigned int node_idx = stack[--top];
+            const bvh_node_t *node = &model->bvh_nodes[node_idx];
+            bool big = node->count > MESHLET_TRIANGLES && node->left;
+            if (!big && values[node_idx] <= 0) continue;
+
+            const meshlet_t *candidate = &candidates[node_idx];
+            if (big || (node->left && values[node_idx] >
+                                          meshlet_value(candidate,
+                                                        node->count))) {
+                model->node_meshlets[node_idx] = MESHLET_SPLIT;
+                stack[top++] = node->left + 1;
+                stack[top++] = node->left;
+                continue;
+            }
+
+            model->node_meshlets[node_idx] = model->meshlet_count;
+            model->meshlets[model->meshlet_count++] = *candidate;
+        }
+    }
+    free(candidates);
+    free(values);
+
+    size_t size = sizeof(meshlet_t) * (model->meshlet_count + 1);
+    meshlet_t *meshlets = realloc(model->meshlets, size);
+    if (meshlets) model->meshlets = meshlets;
+
+    return true;
+}
+
+bool meshlet_backfacing(const meshlet_t *meshlet, const vec3_t *camera) {
+    if (meshlet->cone_cos <= 0) return false;
+
+    // a triangle is culled when the camera lies behind its plane, that is
+    // when dot(A - p, N) = dot(c - p, N) + dot(A - c, N) < 0 for its first
+    // vertex A. Over every normal of the cone dot(c - p, N) is at most the
+    // first two terms and the offset bounds the second dot
+    vec3_t c = vec3_sub(&meshlet->center, camera);
+    float distance = sqrtf(vec3_dot(&c, &c));
+    return vec3_dot(&c, &meshlet->cone_axis) * meshlet->cone_cos +
+               distance * meshlet->cone_sin + meshlet->cone_offset <
+           0;
+}
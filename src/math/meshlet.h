@@ -0,0 +1,24 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "../engine.h"
+
+// Meshlets are bvh subtrees of at most this many triangles, or bigger leaves
+#define MESHLET_TRIANGLES 64
+
+// model->node_meshlets of the nodes above the meshlets, they are always split
+// to reach them
+#define MESHLET_SPLIT ((unsigned int)-2)
+// and of the nodes below them, or where no meshlet is worth testing
+#define NO_MESHLET ((unsigned int)-1)
+
+// Picks the meshlets of every mesh out of its bvh, down from subtrees of
+// MESHLET_TRIANGLES while narrower cones are expected to cull more than the
+// extra tests cost, and fills model->meshlets and model->node_meshlets
+bool build_model_meshlets(model_t *model);
+
+// True when every triangle of the meshlet faces away from a camera at the
+// model space position camera
+bool meshlet_backfacing(const meshlet_t *meshlet, const vec3_t *camera);
+
+#endif // !MESHLET_H
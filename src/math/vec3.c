@@ -2,6 +2,20 @@
 #include <math.h>
 #include <stdio.h>
 
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+vec3_t (*vec3_norm)(const vec3_t *v) = vec3_norm_scalar;
+void (*matrix_transformation)(vec4_t *vec,
+                              const matrix_t *m) = matrix_transformation_scalar;
+void (*transform_points)(float *x, float *y, float *z, const vec3_t *points,
+                         int count,
+                         const matrix_t *m) = transform_points_scalar;
+
 vec3_t vec3_sub(const vec3_t *a, const vec3_t *b) {
     // return (vec3_t){a->x - b->x, a->y - b->y, a->z - b->z, a->color};
     return (vec3_t){a->x - b->x, a->y - b->y, a->z - b->z};
@@ -28,7 +42,7 @@ vec2_t vec2_mul(const vec2_t *a, const float factor) {
     return (vec2_t){a->x * factor, a->y * factor};
 }
 
-vec3_t vec3_norm_slow(const vec3_t *v) {
+vec3_t vec3_norm_scalar(const vec3_t *v) {
     float magnitude;
     vec3_t out;
     magnitude = 1 / sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
@@ -40,32 +54,42 @@ vec3_t vec3_norm_slow(const vec3_t *v) {
     return out;
 }
 
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1"))) vec3_t vec3_norm_sse41(const vec3_t *v) {
+    vec3_t out;
+
+    __m128 v_4 = _mm_setr_ps(v->x, v->y, v->z, 0);
+    // dot of the xyz lanes broadcast to every lane
+    __m128 magnitude = _mm_sqrt_ps(_mm_dp_ps(v_4, v_4, 0x7F));
+    v_4 = _mm_div_ps(v_4, magnitude);
+
+    float result[4];
+    _mm_storeu_ps(result, v_4);
+    out = (vec3_t){result[0], result[1], result[2]};
+
+    return out;
+}
+#endif
+
 #ifdef __ARM_NEON__
-vec3_t vec3_norm_fast(const vec3_t *v) {
+vec3_t vec3_norm_neon(const vec3_t *v) {
     float magnitude;
     vec3_t out;
 
-    float32x4_t v_4 = vld1q_f32((float *)v);
+    float32x4_t v_4 = {v->x, v->y, v->z, 0};
     magnitude = 0;
     float32x4_t another = vmulq_f32(v_4, v_4);
     magnitude = vaddvq_f32(another);
     magnitude = 1 / sqrtf(magnitude);
     v_4 = vmulq_n_f32(v_4, magnitude);
-    vst1q_f32((float *)&out, v_4);
 
-    return out;
-}
-#endif
+    float result[4];
+    vst1q_f32(result, v_4);
+    out = (vec3_t){result[0], result[1], result[2]};
 
-vec3_t vec3_norm(const vec3_t *v) {
-    vec3_t out;
-#ifdef __ARM_NEON__
-    out = vec3_norm_fast(v);
-#else
-    out = vec3_norm_slow(v);
-#endif
     return out;
 }
+#endif
 
 vec3_t vec3_cross(const vec3_t *a, const vec3_t *b) {
     return (vec3_t){
@@ -83,7 +107,7 @@ float vec3_cross_2d(const vec3_t *a, const vec3_t *b) {
     return a->x * b->y - a->y * b->x;
 }
 
-void matrix_transformation(vec4_t *vec, const matrix_t *m) {
+void matrix_transformation_scalar(vec4_t *vec, const matrix_t *m) {
     float x = vec->x;
     float y = vec->y;
     float z = vec->z;
@@ -96,6 +120,124 @@ void matrix_transformation(vec4_t *vec, const matrix_t *m) {
     vec->w = m->m3 * x + m->m7 * y + m->m11 * z + m->m15 * w;
 }
 
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1"))) void
+matrix_transformation_sse41(vec4_t *vec, const matrix_t *m) {
+    const float *rows = (const float *)m;
+    __m128 v_4 = _mm_load_ps((const float *)vec);
+
+    // every row dotted with the vector, each result lands in its own lane
+    __m128 x = _mm_dp_ps(_mm_load_ps(&rows[0]), v_4, 0xF1);
+    __m128 y = _mm_dp_ps(_mm_load_ps(&rows[4]), v_4, 0xF2);
+    __m128 z = _mm_dp_ps(_mm_load_ps(&rows[8]), v_4, 0xF4);
+    __m128 w = _mm_dp_ps(_mm_load_ps(&rows[12]), v_4, 0xF8);
+
+    _mm_store_ps((float *)vec, _mm_or_ps(_mm_or_ps(x, y), _mm_or_ps(z, w)));
+}
+#endif
+
+#ifdef __ARM_NEON__
+void matrix_transformation_neon(vec4_t *vec, const matrix_t *m) {
+    // de-interleaving the rows gives the columns
+    float32x4x4_t columns = vld4q_f32((const float *)m);
+
+    float32x4_t v_4 = vmulq_n_f32(columns.val[0], vec->x);
+    v_4 = vfmaq_n_f32(v_4, columns.val[1], vec->y);
+    v_4 = vfmaq_n_f32(v_4, columns.val[2], vec->z);
+    v_4 = vfmaq_n_f32(v_4, columns.val[3], vec->w);
+
+    vst1q_f32((float *)vec, v_4);
+}
+#endif
+
+void transform_points_scalar(float *x, float *y, float *z,
+                             const vec3_t *points, int count,
+                             const matrix_t *m) {
+    for (int i = 0; i < count; i++) {
+        const vec3_t *p = &points[i];
+        x[i] = m->m0 * p->x + m->m4 * p->y + m->m8 * p->z + m->m12;
+        y[i] = m->m1 * p->x + m->m5 * p->y + m->m9 * p->z + m->m13;
+        z[i] = m->m2 * p->x + m->m6 * p->y + m->m10 * p->z + m->m14;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1"))) void
+transform_points_sse41(float *x, float *y, float *z, const vec3_t *points,
+                       int count, const matrix_t *m) {
+    int i = 0;
+    // every point is loaded as 4 floats, so the last one is left to the
+    // scalar tail to never read past the array
+    for (; i + 4 < count; i += 4) {
+        __m128 xs = _mm_loadu_ps((const float *)&points[i + 0]);
+        __m128 ys = _mm_loadu_ps((const float *)&points[i + 1]);
+        __m128 zs = _mm_loadu_ps((const float *)&points[i + 2]);
+        __m128 ws = _mm_loadu_ps((const float *)&points[i + 3]);
+        // one point per register in, one coordinate per register out
+        _MM_TRANSPOSE4_PS(xs, ys, zs, ws);
+
+        __m128 out = _mm_set1_ps(m->m12);
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m0), xs));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m4), ys));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m8), zs));
+        _mm_storeu_ps(&x[i], out);
+
+        out = _mm_set1_ps(m->m13);
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m1), xs));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m5), ys));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m9), zs));
+        _mm_storeu_ps(&y[i], out);
+
+        out = _mm_set1_ps(m->m14);
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m2), xs));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m6), ys));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(m->m10), zs));
+        _mm_storeu_ps(&z[i], out);
+    }
+    transform_points_scalar(&x[i], &y[i], &z[i], &points[i], count - i, m);
+}
+#endif
+
+#ifdef __ARM_NEON__
+void transform_points_neon(float *x, float *y, float *z, const vec3_t *points,
+                           int count, const matrix_t *m) {
+    int i = 0;
+    // every point is loaded as 4 floats, so the last one is left to the
+    // scalar tail to never read past the array
+    for (; i + 4 < count; i += 4) {
+        float32x4x2_t p01 = vtrnq_f32(vld1q_f32((const float *)&points[i + 0]),
+                                      vld1q_f32((const float *)&points[i + 1]));
+        float32x4x2_t p23 = vtrnq_f32(vld1q_f32((const float *)&points[i + 2]),
+                                      vld1q_f32((const float *)&points[i + 3]));
+        float32x4_t xs =
+            vcombine_f32(vget_low_f32(p01.val[0]), vget_low_f32(p23.val[0]));
+        float32x4_t ys =
+            vcombine_f32(vget_low_f32(p01.val[1]), vget_low_f32(p23.val[1]));
+        float32x4_t zs =
+            vcombine_f32(vget_high_f32(p01.val[0]), vget_high_f32(p23.val[0]));
+
+        float32x4_t out = vdupq_n_f32(m->m12);
+        out = vfmaq_n_f32(out, xs, m->m0);
+        out = vfmaq_n_f32(out, ys, m->m4);
+        out = vfmaq_n_f32(out, zs, m->m8);
+        vst1q_f32(&x[i], out);
+
+        out = vdupq_n_f32(m->m13);
+        out = vfmaq_n_f32(out, xs, m->m1);
+        out = vfmaq_n_f32(out, ys, m->m5);
+        out = vfmaq_n_f32(out, zs, m->m9);
+        vst1q_f32(&y[i], out);
+
+        out = vdupq_n_f32(m->m14);
+        out = vfmaq_n_f32(out, xs, m->m2);
+        out = vfmaq_n_f32(out, ys, m->m6);
+        out = vfmaq_n_f32(out, zs, m->m10);
+        vst1q_f32(&z[i], out);
+    }
+    transform_points_scalar(&x[i], &y[i], &z[i], &points[i], count - i, m);
+}
+#endif
+
 vec3_t vec4_to_vec3(const vec4_t *v4) {
     return (vec3_t){
         // divide by w because of homogeneous coords
@@ -4,7 +4,6 @@
 #define MESH_SIZE
 #define PI 3.14159265359f
 
-#include <arm_neon.h>
 /* extern __m128 _mm_add_ps( __m128 _A, __m128 _B ); */
 
 typedef struct vec2_t {
@@ -12,18 +11,20 @@ typedef struct vec2_t {
     float y;
 } vec2_t;
 
+// Tightly packed, it is the storage type of every vertex, normal and uv array
 typedef struct {
     float x;
     float y;
     float z;
-} __attribute__((aligned (64))) vec3_t ;
+} vec3_t;
 
+// One SIMD register wide, the kernels load and store it whole
 typedef struct vec4_t {
     float x;
     float y;
     float z;
     float w;
-} vec4_t;
+} __attribute__((aligned(16))) vec4_t;
 
 typedef vec4_t quaternion_t;
 
@@ -32,22 +33,59 @@ typedef struct matrix_t {
     float m1, m5, m9, m13;  // Matrix second row (4 components)
     float m2, m6, m10, m14; // Matrix third row (4 components)
     float m3, m7, m11, m15; // Matrix fourth row (4 components)
-} matrix_t;
+} __attribute__((aligned(16))) matrix_t;
 
 vec3_t vec3_sub(const vec3_t *a, const vec3_t *b);
 vec3_t vec3_add(const vec3_t *a, const vec3_t *b);
 vec3_t vec3_mul(const vec3_t *a, const float factor);
-vec3_t vec3_norm(const vec3_t *v);
 float vec3_dot(const vec3_t *a, const vec3_t *b);
 vec3_t vec3_cross(const vec3_t *a, const vec3_t *b);
 float vec3_cross_2d(const vec3_t *a, const vec3_t *b);
 
-void matrix_transformation(vec4_t *vec, const matrix_t *m);
 vec3_t vec4_to_vec3(const vec4_t *v4);
 vec4_t vec3_to_vec4(const vec3_t *v3);
 
 float lerp(float start, float end, float t);
 
+// Bound by init_cpu_dispatch, the scalar versions are always available
+extern vec3_t (*vec3_norm)(const vec3_t *v);
+extern void (*matrix_transformation)(vec4_t *vec, const matrix_t *m);
+
+vec3_t vec3_norm_scalar(const vec3_t *v);
+vec3_t vec3_norm_sse41(const vec3_t *v);
+vec3_t vec3_norm_neon(const vec3_t *v);
+void matrix_transformation_scalar(vec4_t *vec, const matrix_t *m);
+void matrix_transformation_sse41(vec4_t *vec, const matrix_t *m);
+void matrix_transformation_neon(vec4_t *vec, const matrix_t *m);
+
+// Applies an affine m (bottom row 0, 0, 0, 1) to count points and writes the
+// results as separate x, y and z arrays
+extern void (*transform_points)(float *x,
+                                float *y,
+                                float *z,
+                                const vec3_t *points,
+                                int count,
+                                const matrix_t *m);
+
+void transform_points_scalar(float *x,
+                             float *y,
+                             float *z,
+                             const vec3_t *points,
+                             int count,
+                             const matrix_t *m);
+void transform_points_sse41(float *x,
+                            float *y,
+                            float *z,
+                            const vec3_t *points,
+                            int count,
+                            const matrix_t *m);
+void transform_points_neon(float *x,
+                           float *y,
+                           float *z,
+                           const vec3_t *points,
+                           int count,
+                           const matrix_t *m);
+
 vec4_t vec4_norm(const vec4_t *v4);
 float vec4_dot(const vec4_t *A, const vec4_t *B);
 float distance_to_plane(const vec4_t *plane, const vec3_t *point);
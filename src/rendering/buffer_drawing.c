@@ -1,278 +1,462 @@
 #include "buffer_drawing.h"
+#include "../math/bvh.h"
 #include "../math/graphics_pipeline.h"
+#include "../math/meshlet.h"
 #include "rasterizer.h"
+#include "tile_binning.h"
+
+#include <string.h>
+
+// Smaller bvh nodes are drawn without an occlusion test
+#define OCCLUSION_MIN_TRIANGLES 32
+
+// Clip space x and y may reach this many times w before a triangle is clipped
+// against them, up to there the tile rect it is binned with clamps it to the
+// screen
+#define GUARD_BAND 4.0f
+
+// Outcode bits of a clip space point, the guard band bit is set when the
+// point lies beyond it on any side
+enum {
+    OUT_NEAR = 1 << 0,
+    OUT_FAR = 1 << 1,
+    OUT_LEFT = 1 << 2,
+    OUT_RIGHT = 1 << 3,
+    OUT_BOTTOM = 1 << 4,
+    OUT_TOP = 1 << 5,
+    OUT_GUARD_BAND = 1 << 6,
+};
+
+// Planes triangles are clipped against in clip space, near, far and the four
+// sides of the guard band. A point p is inside while dot(plane, p) >= 0
+#define CLIP_SPACE_PLANES 6
+static const vec4_t clip_space_planes[CLIP_SPACE_PLANES] = {
+    {0, 0, 1, 1},
+    {0, 0, -1, 1},
+    {1, 0, 0, GUARD_BAND},
+    {-1, 0, 0, GUARD_BAND},
+    {0, 1, 0, GUARD_BAND},
+    {0, -1, 0, GUARD_BAND},
+};
+
+// Every plane a polygon is clipped against adds at most one vertex
+#define MAX_CLIP_VERTICES (3 + CLIP_SPACE_PLANES)
+
+typedef struct {
+    vec4_t position;
+    vec3_t uv;
+} clip_vertex_t;
+
+static unsigned int outcode(const vec4_t *p) {
+    unsigned int code = 0;
+    if (p->z < -p->w) code |= OUT_NEAR;
+    if (p->z > p->w) code |= OUT_FAR;
+    if (p->x < -p->w) code |= OUT_LEFT;
+    if (p->x > p->w) code |= OUT_RIGHT;
+    if (p->y < -p->w) code |= OUT_BOTTOM;
+    if (p->y > p->w) code |= OUT_TOP;
+    if (fabsf(p->x) > GUARD_BAND * p->w || fabsf(p->y) > GUARD_BAND * p->w)
+        code |= OUT_GUARD_BAND;
+    return code;
+}
 
-void project_and_draw(state_t *state, const vec3_t *A, const vec3_t *A_uv,
-                      const vec3_t *B, const vec3_t *B_uv, const vec3_t *C,
-                      const vec3_t *C_uv, const vec3_t *face_normal,
-                      const tex_t *tex) {
-    /* printf("After clipping\n"); */
-
-    vec4_t A_4 = vec3_to_vec4(A);
-    vec4_t B_4 = vec3_to_vec4(B);
-    vec4_t C_4 = vec3_to_vec4(C);
-
-    // ------------------- Projection Transform -------------------- //
-    matrix_transformation(&A_4, &state->engine->projection_transform);
-    matrix_transformation(&B_4, &state->engine->projection_transform);
-    matrix_transformation(&C_4, &state->engine->projection_transform);
-
-    vec3_t A_uv_proj;
-    vec3_t B_uv_proj;
-    vec3_t C_uv_proj;
-
-    if (A_uv != NULL && B_uv != NULL && C_uv != NULL) {
-        A_uv_proj = vec3_mul(A_uv, 1 / A_4.w);
-        B_uv_proj = vec3_mul(B_uv, 1 / B_4.w);
-        C_uv_proj = vec3_mul(C_uv, 1 / C_4.w);
-    }
-
-    vec3_t A_proj = vec4_to_vec3(&A_4);
-    vec3_t B_proj = vec4_to_vec3(&B_4);
-    vec3_t C_proj = vec4_to_vec3(&C_4);
-
-    float max_x = fmax(A_proj.x, fmax(B_proj.x, C_proj.x));
-    float max_y = fmax(A_proj.y, fmax(B_proj.y, C_proj.y));
-    float max_z = fmax(A_proj.z, fmax(B_proj.z, C_proj.z));
-
-    float min_x = fmin(A_proj.x, fmin(B_proj.x, C_proj.x));
-    float min_y = fmin(A_proj.y, fmin(B_proj.y, C_proj.y));
-    float min_z = fmin(A_proj.z, fmin(B_proj.z, C_proj.z));
-
-    if (fmax(max_x, fmax(max_y, max_z)) > 2 ||
-        fmin(min_x, fmin(min_y, min_z)) < -2) {
-        return;
+static void project_and_draw(state_t *state, const clip_vertex_t *A,
+                             const clip_vertex_t *B, const clip_vertex_t *C,
+                             const bool has_uv, const vec3_t *face_normal,
+                             const tex_t *tex) {
+    const clip_vertex_t *vertices[3] = {A, B, C};
+    vec3_t ABC[3];
+    vec3_t ABC_uv[3];
+
+    for (int i = 0; i < 3; i++) {
+        vec4_t p = vertices[i]->position;
+        // uv / w is what varies linearly across the screen
+        if (has_uv) ABC_uv[i] = vec3_mul(&vertices[i]->uv, 1 / p.w);
+
+        // ------------------- Viewport transform -------------------- //
+        matrix_transformation(&p, &state->engine->viewport_transform);
+        ABC[i] = vec4_to_vec3(&p);
     }
 
-    // ------------------- Viewport transform -------------------- //
-    matrix_transformation(&A_4, &state->engine->viewport_transform);
-    matrix_transformation(&B_4, &state->engine->viewport_transform);
-    matrix_transformation(&C_4, &state->engine->viewport_transform);
-
-    const vec3_t A_vp = vec4_to_vec3(&A_4);
-    const vec3_t B_vp = vec4_to_vec3(&B_4);
-    const vec3_t C_vp = vec4_to_vec3(&C_4);
-
     // ---------------------- Draw Triangle ----------------------- //
-    draw_triangle(state, A_vp, A_uv == NULL ? NULL : &A_uv_proj, B_vp,
-                  B_uv == NULL ? NULL : &B_uv_proj, C_vp,
-                  C_uv == NULL ? NULL : &C_uv_proj, *face_normal, tex);
-    /* draw_textured_triangle(state, A_vp, B_vp, C_vp, *face_normal); */
+    draw_triangle(state, ABC[0], has_uv ? &ABC_uv[0] : NULL, ABC[1],
+                  has_uv ? &ABC_uv[1] : NULL, ABC[2],
+                  has_uv ? &ABC_uv[2] : NULL, *face_normal, tex);
 }
 
-void clip_and_draw(state_t *state, const vec3_t *A, const vec3_t *A_uv,
-                   const vec3_t *B, const vec3_t *B_uv, const vec3_t *C,
-                   const vec3_t *C_uv, const int plane_id,
-                   const vec3_t *face_normal, const tex_t *tex) {
-    // If the plane_id is invalid stop
-    if (plane_id >= CLIPPING_PLANES) return;
-
-    // If already clipped against all planes draw the triangle
-    if (plane_id < 0) {
-        project_and_draw(state, A, A_uv, B, B_uv, C, C_uv, face_normal, tex);
-        return;
-    }
+// Point of the edge from the inside vertex a to the outside one b where the
+// plane distance d_a, d_b crosses 0. Edges shared by two triangles are always
+// cut from the same side so both get the same point
+static clip_vertex_t clip_edge(const clip_vertex_t *a, const clip_vertex_t *b,
+                               const float d_a, const float d_b) {
+    float t = d_a / (d_a - d_b);
+    return (clip_vertex_t){
+        .position =
+            {
+                a->position.x + (b->position.x - a->position.x) * t,
+                a->position.y + (b->position.y - a->position.y) * t,
+                a->position.z + (b->position.z - a->position.z) * t,
+                a->position.w + (b->position.w - a->position.w) * t,
+            },
+        .uv =
+            {
+                a->uv.x + (b->uv.x - a->uv.x) * t,
+                a->uv.y + (b->uv.y - a->uv.y) * t,
+                a->uv.z + (b->uv.z - a->uv.z) * t,
+            },
+    };
+}
 
-    vec4_t plane = state->engine->clipping_planes[plane_id];
-
-    float da = distance_to_plane(&plane, A);
-    float db = distance_to_plane(&plane, B);
-    float dc = distance_to_plane(&plane, C);
-
-    unsigned short negative_counter = 0;
-    da < 0 ? negative_counter++ : 0;
-    db < 0 ? negative_counter++ : 0;
-    dc < 0 ? negative_counter++ : 0;
-
-    // if the triangle is outside the entire clipping plane dont render it
-    if (negative_counter == 3) return;
-
-    // if two of the vertices are outside the clipping plane then translate both
-    // to the plane intersection with the triangle edges
-    if (negative_counter == 2) {
-        if (da > 0) {
-            vec3_t B_uv_;
-            vec3_t B_ =
-                intersection_plane_segment(&plane, A, A_uv, B, B_uv, &B_uv_);
-            vec3_t C_uv_;
-            vec3_t C_ =
-                intersection_plane_segment(&plane, A, A_uv, C, C_uv, &C_uv_);
-            clip_and_draw(state, A, A_uv, &B_, A_uv == NULL ? NULL : &B_uv_,
-                          &C_, A_uv == NULL ? NULL : &C_uv_, plane_id - 1,
-                          face_normal, tex);
-        } else if (db > 0) {
-            vec3_t A_uv_;
-            vec3_t A_ =
-                intersection_plane_segment(&plane, B, B_uv, A, A_uv, &A_uv_);
-            vec3_t C_uv_;
-            vec3_t C_ =
-                intersection_plane_segment(&plane, B, B_uv, C, C_uv, &C_uv_);
-            clip_and_draw(state, &A_, A_uv == NULL ? NULL : &A_uv_, B, B_uv,
-                          &C_, A_uv == NULL ? NULL : &C_uv_, plane_id - 1,
-                          face_normal, tex);
-        } else if (dc > 0) {
-            vec3_t A_uv_;
-            vec3_t A_ =
-                intersection_plane_segment(&plane, C, C_uv, A, A_uv, &A_uv_);
-            vec3_t B_uv_;
-            vec3_t B_ =
-                intersection_plane_segment(&plane, C, C_uv, B, B_uv, &B_uv_);
-            clip_and_draw(state, &A_, A_uv == NULL ? NULL : &A_uv_, &B_,
-                          A_uv == NULL ? NULL : &B_uv_, C, C_uv, plane_id - 1,
-                          face_normal, tex);
+// Clips the triangle in clip space against the near and far planes and the
+// guard band, one plane after the other, and draws what is left as a fan
+static void clip_and_draw(state_t *state, const clip_vertex_t ABC[3],
+                          const bool has_uv, const vec3_t *face_normal,
+                          const tex_t *tex) {
+    clip_vertex_t buffers[2][MAX_CLIP_VERTICES];
+    clip_vertex_t *in = buffers[0];
+    clip_vertex_t *out = buffers[1];
+    int count = 3;
+    for (int i = 0; i < 3; i++) in[i] = ABC[i];
+
+    for (int i = 0; i < CLIP_SPACE_PLANES; i++) {
+        float distances[MAX_CLIP_VERTICES];
+        bool outside = false;
+        for (int j = 0; j < count; j++) {
+            distances[j] = vec4_dot(&clip_space_planes[i], &in[j].position);
+            outside = outside || distances[j] < 0;
         }
-        return;
-    }
-
-    // if only one vertex is outside the clipping plane then create new vertices
-    // and two new triangles from them to clip
-    if (negative_counter == 1) {
-        if (da < 0) {
-            vec3_t A_uv_1;
-            vec3_t A_1 =
-                intersection_plane_segment(&plane, A, A_uv, B, B_uv, &A_uv_1);
-            vec3_t A_uv_2;
-            vec3_t A_2 =
-                intersection_plane_segment(&plane, A, A_uv, C, C_uv, &A_uv_2);
-            clip_and_draw(state, B, B_uv, &A_2, A_uv == NULL ? NULL : &A_uv_2,
-                          &A_1, A_uv == NULL ? NULL : &A_uv_1, plane_id - 1,
-                          face_normal, tex);
-            clip_and_draw(state, B, B_uv, C, C_uv, &A_2,
-                          A_uv == NULL ? NULL : &A_uv_2, plane_id - 1,
-                          face_normal, tex);
-        } else if (db < 0) {
-            vec3_t B_uv_1;
-            vec3_t B_1 =
-                intersection_plane_segment(&plane, B, B_uv, C, C_uv, &B_uv_1);
-            vec3_t B_uv_2;
-            vec3_t B_2 =
-                intersection_plane_segment(&plane, B, B_uv, A, A_uv, &B_uv_2);
-            clip_and_draw(state, C, C_uv, &B_2, A_uv == NULL ? NULL : &B_uv_2,
-                          &B_1, A_uv == NULL ? NULL : &B_uv_1, plane_id - 1,
-                          face_normal, tex);
-            clip_and_draw(state, C, C_uv, A, A_uv, &B_2,
-                          A_uv == NULL ? NULL : &B_uv_2, plane_id - 1,
-                          face_normal, tex);
-        } else if (dc < 0) {
-            vec3_t C_uv_1;
-            vec3_t C_1 =
-                intersection_plane_segment(&plane, C, C_uv, A, A_uv, &C_uv_1);
-            vec3_t C_uv_2;
-            vec3_t C_2 =
-                intersection_plane_segment(&plane, C, C_uv, B, B_uv, &C_uv_2);
-            clip_and_draw(state, A, A_uv, &C_2, A_uv == NULL ? NULL : &C_uv_2,
-                          &C_1, A_uv == NULL ? NULL : &C_uv_1, plane_id - 1,
-                          face_normal, tex);
-            clip_and_draw(state, A, A_uv, B, B_uv, &C_2,
-                          A_uv == NULL ? NULL : &C_uv_2, plane_id - 1,
-                          face_normal, tex);
+        if (!outside) continue;
+
+        int out_count = 0;
+        for (int j = 0; j < count; j++) {
+            int k = j + 1 < count ? j + 1 : 0;
+            bool j_inside = distances[j] >= 0;
+            bool k_inside = distances[k] >= 0;
+            if (j_inside) out[out_count++] = in[j];
+            if (j_inside && !k_inside)
+                out[out_count++] =
+                    clip_edge(&in[j], &in[k], distances[j], distances[k]);
+            else if (!j_inside && k_inside)
+                out[out_count++] =
+                    clip_edge(&in[k], &in[j], distances[k], distances[j]);
         }
-        return;
+
+        // the triangle was entirely outside the plane
+        if (out_count < 3) return;
+
+        clip_vertex_t *tmp = in;
+        in = out;
+        out = tmp;
+        count = out_count;
     }
 
-    clip_and_draw(state, A, A_uv, B, B_uv, C, C_uv, plane_id - 1, face_normal,
-                  tex);
+    for (int i = 1; i + 1 < count; i++) {
+        project_and_draw(state, &in[0], &in[i], &in[i + 1], has_uv,
+                         face_normal, tex);
+    }
 }
 
 void process_and_draw_triangle(state_t *state, const model_t *model,
-                               const int mesh_idx, const int triangle_id) {
+                               const int mesh_idx, const int triangle_id,
+                               const bool clip) {
     mesh_t *mesh = &model->meshes[mesh_idx];
+
+    // ------------------------ Backface Culling -------------------------
+
+    // the camera and the planes share model space, so a single dot decides
+    const vec4_t *face_plane = &mesh->face_planes[triangle_id];
+    if (distance_to_plane(face_plane, &state->engine->camera->position) > 0)
+        return;
+    const vec3_t face_normal = {face_plane->x, face_plane->y, face_plane->z};
+
     // Assign vertices
     unsigned int A_index = mesh->v_indices[triangle_id * 3 + 0];
     unsigned int B_index = mesh->v_indices[triangle_id * 3 + 1];
     unsigned int C_index = mesh->v_indices[triangle_id * 3 + 2];
-    const vec3_t A = model->vertices[A_index];
-    const vec3_t B = model->vertices[B_index];
-    const vec3_t C = model->vertices[C_index];
 
     /* printf("Before accessing uv's\n"); */
-    vec3_t *A_uvp = NULL;
-    vec3_t *B_uvp = NULL;
-    vec3_t *C_uvp = NULL;
+    const vec3_t *uvs[3] = {NULL, NULL, NULL};
     if (model->tex_coords != NULL) {
         unsigned int A_uv_index = mesh->t_indices[triangle_id * 3 + 0];
         unsigned int B_uv_index = mesh->t_indices[triangle_id * 3 + 1];
         unsigned int C_uv_index = mesh->t_indices[triangle_id * 3 + 2];
 
         if (A_uv_index != -1 && B_uv_index != -1 && C_uv_index != -1) {
-            A_uvp = &model->tex_coords[A_uv_index];
-            B_uvp = &model->tex_coords[B_uv_index];
-            C_uvp = &model->tex_coords[C_uv_index];
+            uvs[0] = &model->tex_coords[A_uv_index];
+            uvs[1] = &model->tex_coords[B_uv_index];
+            uvs[2] = &model->tex_coords[C_uv_index];
         }
     }
-
-    // Calculate face normal
-    vec3_t face_normal;
-    vec3_t AB = vec3_sub(&B, &A);
-    vec3_t AC = vec3_sub(&C, &A);
-    if (model->normals != NULL) {
-        unsigned int A_norm_index = mesh->n_indices[triangle_id * 3 + 0];
-        unsigned int B_norm_index = mesh->n_indices[triangle_id * 3 + 1];
-        unsigned int C_norm_index = mesh->n_indices[triangle_id * 3 + 2];
-
-        if (A_norm_index == -1 || B_norm_index == -1 || C_norm_index == -1) {
-            face_normal = vec3_cross(&AC, &AB);
-            face_normal = vec3_norm(&face_normal);
-        } else {
-            vec3_t A_n = model->normals[A_norm_index];
-            vec3_t B_n = model->normals[B_norm_index];
-            vec3_t C_n = model->normals[C_norm_index];
-            face_normal = (vec3_t){
-                A_n.x + B_n.x + C_n.x, 
-                A_n.y + B_n.y + C_n.y, 
-                A_n.z + B_n.z + C_n.z, 
-            };
-            face_normal = vec3_norm(&face_normal);
-        }
-    } else {
-        face_normal = vec3_cross(&AB, &AC);
-        face_normal = vec3_norm(&face_normal);
-    }
-
-    /* if (vec3_dot(&A, &face_normal) < 0) return; */
-    vec3_t camera_to_norm = vec3_add(&A, &face_normal);
-
-    // Assign vec4
-    vec4_t A_4 = vec3_to_vec4(&A);
-    vec4_t B_4 = vec3_to_vec4(&B);
-    vec4_t C_4 = vec3_to_vec4(&C);
-    vec4_t CN_4 = vec3_to_vec4(&camera_to_norm);
+    bool has_uv = uvs[0] != NULL;
 
     // ------------------------- View Transform --------------------------
 
-    matrix_transformation(&A_4, &state->engine->view_transform);
-    matrix_transformation(&B_4, &state->engine->view_transform);
-    matrix_transformation(&C_4, &state->engine->view_transform);
-    matrix_transformation(&CN_4, &state->engine->view_transform);
-    const vec3_t A_view = vec4_to_vec3(&A_4);
-    const vec3_t B_view = vec4_to_vec3(&B_4);
-    const vec3_t C_view = vec4_to_vec3(&C_4);
-
-    vec3_t camera_to_norm_view = vec4_to_vec3(&CN_4);
-    vec3_t face_normal_view = vec3_sub(&camera_to_norm_view, &A_view);
+    // the vertices were transformed once for the whole model in draw_meshes
+    unsigned int indices[3] = {A_index, B_index, C_index};
+    clip_vertex_t ABC[3];
+    for (int i = 0; i < 3; i++) {
+        ABC[i].position = (vec4_t){model->view_x[indices[i]],
+                                   model->view_y[indices[i]],
+                                   model->view_z[indices[i]], 1};
+        ABC[i].uv = has_uv ? *uvs[i] : (vec3_t){0, 0, 0};
+    }
 
-    // ------------------------ Backface Culling -------------------------
+    // ---------------------- Projection Transform -----------------------
 
-    if (vec3_dot(&A_view, &face_normal_view) < 0) return;
+    for (int i = 0; i < 3; i++) {
+        matrix_transformation(&ABC[i].position,
+                              &state->engine->projection_transform);
+    }
 
     // ----------------------- Triangle clipping -------------------------
 
     tex_t *diffuse_tex = NULL;
     if (mesh->mtl && mesh->mtl->diffuse_tex_idx != -1)
         diffuse_tex = &model->textures[mesh->mtl->diffuse_tex_idx];
-    clip_and_draw(state, &A_view, A_uvp, &B_view, B_uvp, &C_view, C_uvp,
-                  CLIPPING_PLANES - 1, &face_normal, diffuse_tex);
+    if (!clip) {
+        project_and_draw(state, &ABC[0], &ABC[1], &ABC[2], has_uv,
+                         &face_normal, diffuse_tex);
+        return;
+    }
+
+    // outside the same frustum plane is outside the frustum, only the near
+    // and far planes and the guard band need actual clipping
+    unsigned int A_code = outcode(&ABC[0].position);
+    unsigned int B_code = outcode(&ABC[1].position);
+    unsigned int C_code = outcode(&ABC[2].position);
+    if (A_code & B_code & C_code & ~OUT_GUARD_BAND) return;
+    if ((A_code | B_code | C_code) & (OUT_NEAR | OUT_FAR | OUT_GUARD_BAND)) {
+        clip_and_draw(state, ABC, has_uv, &face_normal, diffuse_tex);
+        return;
+    }
+    project_and_draw(state, &ABC[0], &ABC[1], &ABC[2], has_uv, &face_normal,
+                     diffuse_tex);
+}
+
+typedef enum {
+    MESH_OUTSIDE,
+    MESH_INTERSECTS,
+    MESH_INSIDE,
+} mesh_visibility_t;
+
+// Moves a view space plane to world space, where the mesh bounds live. With
+// view = R * p + t a plane (n, d) becomes (R^T * n, n . t + d)
+static vec4_t plane_to_world(const vec4_t *plane, const matrix_t *view) {
+    return (vec4_t){
+        view->m0 * plane->x + view->m1 * plane->y + view->m2 * plane->z,
+        view->m4 * plane->x + view->m5 * plane->y + view->m6 * plane->z,
+        view->m8 * plane->x + view->m9 * plane->y + view->m10 * plane->z,
+        view->m12 * plane->x + view->m13 * plane->y + view->m14 * plane->z +
+            plane->w,
+    };
+}
+
+// Tests a box and a sphere sharing the same center against every clipping
+// plane, per plane the smaller of the two projected radii is used
+static mesh_visibility_t classify_bounds(const vec4_t *planes,
+                                         const vec3_t *center,
+                                         const vec3_t *extents,
+                                         const float sphere_radius) {
+    bool inside = true;
+
+    for (int i = 0; i < CLIPPING_PLANES; i++) {
+        const vec4_t *plane = &planes[i];
+        float distance = distance_to_plane(plane, center);
+
+        // the planes are not normalized, so both radii are scaled by |n|
+        float box_radius = fabsf(plane->x) * extents->x +
+                           fabsf(plane->y) * extents->y +
+                           fabsf(plane->z) * extents->z;
+        float plane_sphere_radius =
+            sphere_radius * sqrtf(plane->x * plane->x + plane->y * plane->y +
+                                  plane->z * plane->z);
+        // a little slack keeps vertices right on a plane going through the
+        // clipper like before
+        float radius =
+            fminf(box_radius, plane_sphere_radius) * 1.001f + 1e-5f;
+
+        if (distance < -radius) return MESH_OUTSIDE;
+        if (distance <= radius) inside = false;
+    }
+
+    return inside ? MESH_INSIDE : MESH_INTERSECTS;
+}
+
+static mesh_visibility_t classify_mesh(const vec4_t *planes,
+                                       const mesh_t *mesh) {
+    vec3_t extents = vec3_sub(&mesh->aabb_max, &mesh->center);
+    return classify_bounds(planes, &mesh->center, &extents, mesh->radius);
+}
+
+// A meshlet's sphere shares the center of its root node's box
+static mesh_visibility_t classify_node(const vec4_t *planes,
+                                       const bvh_node_t *node,
+                                       const float sphere_radius) {
+    vec3_t center = vec3_add(&node->min, &node->max);
+    center = vec3_mul(&center, 0.5f);
+    vec3_t extents = vec3_sub(&node->max, &center);
+    return classify_bounds(planes, &center, &extents, sphere_radius);
+}
+
+static void draw_triangle_range(state_t *state, const model_t *model,
+                                const int mesh_idx, const unsigned int first,
+                                const unsigned int count, const bool clip) {
+    for (unsigned int i = first; i < first + count; i++)
+        process_and_draw_triangle(state, model, mesh_idx, i, clip);
+}
+
+// Projects the node's box to the screen and tests it against the depth the
+// last frame left in the tiles, only valid while the view is the same
+static bool node_occluded(state_t *state, const bvh_node_t *node) {
+    engine_t *engine = state->engine;
+    float x_min = INFINITY, y_min = INFINITY, z_min = INFINITY;
+    float x_max = -INFINITY, y_max = -INFINITY;
+
+    for (int i = 0; i < 8; i++) {
+        vec4_t corner = {
+            i & 1 ? node->max.x : node->min.x,
+            i & 2 ? node->max.y : node->min.y,
+            i & 4 ? node->max.z : node->min.z,
+            1,
+        };
+        matrix_transformation(&corner, &engine->view_transform);
+        // the projection of a box reaching behind the near plane wraps
+        // around, so it is never taken as hidden
+        if (corner.z > engine->near) return false;
+
+        matrix_transformation(&corner, &engine->projection_transform);
+        matrix_transformation(&corner, &engine->viewport_transform);
+        vec3_t p = vec4_to_vec3(&corner);
+        x_min = fminf(x_min, p.x);
+        y_min = fminf(y_min, p.y);
+        x_max = fmaxf(x_max, p.x);
+        y_max = fmaxf(y_max, p.y);
+        z_min = fminf(z_min, p.z);
+    }
+
+    // clamp while still in float, corners close to the near plane project
+    // far past anything an int holds
+    x_min = fmaxf(floorf(x_min), 0);
+    y_min = fmaxf(floorf(y_min), 0);
+    x_max = fminf(ceilf(x_max), SCREEN_WIDTH - 1);
+    y_max = fminf(ceilf(y_max), SCREEN_HEIGHT - 1);
+    if (!(x_min <= x_max && y_min <= y_max)) return false;
+
+    rect_t rect = {x_min, y_min, x_max, y_max};
+
+    return hiz_occludes(state->tile_bins, &rect, z_min);
+}
+
+// Walks the bvh of a mesh, skipping the nodes outside the frustum, the
+// meshlets facing away and, with occlusion on, the nodes behind the previous
+// frame's depth. Nodes fully inside the frustum draw without clipping once
+// down to their meshlet, only the leaves that still cross a plane go through
+// the clipper.
+static void draw_mesh_bvh(state_t *state, const model_t *model,
+                          const int mesh_idx, const vec4_t *planes,
+                          const bool inside, const bool occlusion) {
+    struct {
+        unsigned int node;
+        bool inside;
+    } stack[BVH_MAX_DEPTH + 2];
+    int top = 0;
+    stack[top].node = model->meshes[mesh_idx].bvh_root;
+    stack[top++].inside = inside;
+
+    while (top > 0) {
+        top--;
+        const bvh_node_t *node = &model->bvh_nodes[stack[top].node];
+        unsigned int meshlet_idx = model->node_meshlets[stack[top].node];
+        const meshlet_t *meshlet = NULL;
+        if (meshlet_idx != NO_MESHLET && meshlet_idx != MESHLET_SPLIT)
+            meshlet = &model->meshlets[meshlet_idx];
+
+        mesh_visibility_t visibility = MESH_INSIDE;
+        if (!stack[top].inside) {
+            visibility = classify_node(planes, node,
+                                       meshlet ? meshlet->radius : INFINITY);
+        }
+        if (visibility == MESH_OUTSIDE) continue;
+
+        if (meshlet &&
+            meshlet_backfacing(meshlet, &state->engine->camera->position)) {
+            state->culling.backfacing_meshlets++;
+            state->culling.backfacing_triangles += node->count;
+            continue;
+        }
+
+        // testing small nodes costs more than drawing them
+        bool test = occlusion && node->count >= OCCLUSION_MIN_TRIANGLES;
+        if (test && node_occluded(state, node)) {
+            state->culling.bvh_nodes++;
+            state->culling.bvh_triangles += node->count;
+            continue;
+        }
+
+        // nodes above the meshlets always split to reach their cones
+        bool split = visibility == MESH_INTERSECTS || test ||
+                     meshlet_idx == MESHLET_SPLIT;
+        if (node->left && split) {
+            // the left child is popped, and drawn, first
+            for (int i = 1; i >= 0; i--) {
+                stack[top].node = node->left + i;
+                stack[top++].inside = visibility == MESH_INSIDE;
+            }
+            continue;
+        }
+
+        draw_triangle_range(state, model, mesh_idx, node->first, node->count,
+                            visibility == MESH_INTERSECTS);
+    }
 }
 
 void draw_meshes(state_t *state) {
     engine_t *engine = state->engine;
     engine->view_transform = generate_view_transform(engine->camera);
+
+    vec4_t world_planes[CLIPPING_PLANES];
+    for (int i = 0; i < CLIPPING_PLANES; i++) {
+        world_planes[i] = plane_to_world(&engine->clipping_planes[i],
+                                         &engine->view_transform);
+    }
+
+    // the depth of the last frame still holds while the camera is still
+    tile_bins_t *bins = state->tile_bins;
+    bool occlusion = bins->hiz_valid &&
+                     memcmp(&bins->hiz_view, &engine->view_transform,
+                            sizeof(matrix_t)) == 0;
+    if (state->flags.render_flag == WIREFRAME) {
+        occlusion = false;
+        bins->hiz_valid = false;
+    }
+
+    state->culling.backfacing_meshlets = 0;
+    state->culling.backfacing_triangles = 0;
+    state->culling.bvh_nodes = 0;
+    state->culling.bvh_triangles = 0;
+    state->culling.hiz_triangles = 0;
+    state->culling.hiz_pixels = 0;
+    state->overdraw.shaded_pixels = 0;
+    state->overdraw.prepass_pixels = 0;
+    state->overdraw.prepass_shaded = 0;
+
     model_t **models = engine->models;
     for (int i = 0; i < engine->model_count; i++) {
+        transform_points(models[i]->view_x, models[i]->view_y,
+                         models[i]->view_z, models[i]->vertices,
+                         models[i]->vertex_count, &engine->view_transform);
+
         for (int j = 0; j < models[i]->mesh_count; j++) {
-            for (int l = 0; l < models[i]->meshes[j].triangle_count; l++) {
-                process_and_draw_triangle(state, models[i], j, l);
-            }
+            // whole meshes outside the frustum are skipped and the rest are
+            // culled further down their bvh
+            mesh_visibility_t visibility =
+                classify_mesh(world_planes, &models[i]->meshes[j]);
+            if (visibility == MESH_OUTSIDE) continue;
+
+            draw_mesh_bvh(state, models[i], j, world_planes,
+                          visibility == MESH_INSIDE, occlusion);
         }
     }
+
+    if (state->flags.render_flag != WIREFRAME) flush_tile_bins(state);
 }
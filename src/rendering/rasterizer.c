@@ -1,286 +1,225 @@
 #include "rasterizer.h"
+#include "tile_binning.h"
 #include <math.h>
+#include <string.h>
 
-static bool is_top_left(const vec3_t *start, const vec3_t *end) {
-    vec3_t edge = {end->x - start->x, end->y - start->y};
-    return (edge.y == 0 && edge.x > 0) || edge.y > 0;
-}
+typedef struct {
+    int32_t x;
+    int32_t y;
+} fixed_point_t;
 
-static float edge_cross(const vec3_t *A, const vec3_t *B, const vec3_t *C) {
-    return (C->x - A->x) * (B->y - A->y) - (C->y - A->y) * (B->x - A->x);
+static fixed_point_t snap(const vec3_t *v) {
+    return (fixed_point_t){lrintf(v->x * SUBPIXEL_ONE),
+                           lrintf(v->y * SUBPIXEL_ONE)};
 }
 
-// --------------------------------------------------------------------------//
-
-#ifdef __ARM_NEON__
-
-static float edge_cross_fast(const vec3_t ABC[3]) {
-    return (ABC[2].x - ABC[0].x) * (ABC[1].y - ABC[0].y) -
-           (ABC[2].y - ABC[0].y) * (ABC[1].x - ABC[0].x);
+static bool is_top_left(const fixed_point_t *start, const fixed_point_t *end) {
+    int32_t edge_x = end->x - start->x;
+    int32_t edge_y = end->y - start->y;
+    return (edge_y == 0 && edge_x > 0) || edge_y > 0;
 }
 
-static float32x4_t duplicate_q_f32(const float32x4_t in) {
-    float32x4_t result;
-    result[0] = in[0];
-    result[1] = in[1];
-    result[2] = in[2];
-    result[3] = in[3];
-    return result;
+static int64_t edge_cross(const fixed_point_t *A, const fixed_point_t *B,
+                          const fixed_point_t *C) {
+    return (int64_t)(C->x - A->x) * (B->y - A->y) -
+           (int64_t)(C->y - A->y) * (B->x - A->x);
 }
 
-static void fill_triangle_fast(uint32_t *frame_buffer, float *z_buffer,
-                               vec3_t ABC[3], vec3_t ABC_uv[3],
-                               const vec3_t *face_normal,
-                               const vec3_t *directional_light,
-                               const tex_t *tex) {
-    bool has_tex = ABC_uv && tex;
+// How much of a block an edge function keeps, ordered so the block gets the
+// least of its three edges
+typedef enum { COVER_NONE, COVER_PARTIAL, COVER_FULL } cover_t;
+
+// e is the edge function at the top left pixel of the block, which spans
+// col_span and row_span more in it along the columns and rows
+static cover_t edge_cover(int64_t e, int64_t col_span, int64_t row_span) {
+    int64_t min = e + (col_span < 0 ? col_span : 0) +
+                  (row_span < 0 ? row_span : 0);
+    int64_t max = e + (col_span > 0 ? col_span : 0) +
+                  (row_span > 0 ? row_span : 0);
+    if (max < 0) return COVER_NONE;
+    return min >= 0 ? COVER_FULL : COVER_PARTIAL;
+}
 
-    float area = edge_cross_fast(ABC);
-    if (area < 0) {
-        area = -area;
+static cover_t min_cover(cover_t a, cover_t b) { return a < b ? a : b; }
 
-        vec3_t B_new = ABC[2];
-        ABC[2] = ABC[1];
-        ABC[1] = B_new;
+static float edge_cross_float(const vec3_t *A, const vec3_t *B,
+                              const vec3_t *C) {
+    return (C->x - A->x) * (B->y - A->y) - (C->y - A->y) * (B->x - A->x);
+}
 
-        if (has_tex) {
-            B_new = ABC_uv[2];
-            ABC_uv[2] = ABC_uv[1];
-            ABC_uv[1] = B_new;
-        }
-    }
+// --------------------------------------------------------------------------//
 
-    vec3_t A = ABC[0];
-    vec3_t B = ABC[1];
-    vec3_t C = ABC[2];
+fill_triangle_fn fill_triangle = fill_triangle_scalar;
+float (*block_max_z)(const float *z_buffer) = block_max_z_scalar;
 
-    float x_min = floorf(fminf(A.x, fminf(B.x, C.x)));
-    float x_max = ceilf(fmaxf(A.x, fmaxf(B.x, C.x)));
+float block_max_z_scalar(const float *z_buffer) {
+    float max_z = -INFINITY;
+    for (int y = 0; y < HIZ_BLOCK_SIZE; y++, z_buffer += SCREEN_WIDTH) {
+        for (int x = 0; x < HIZ_BLOCK_SIZE; x++)
+            max_z = z_buffer[x] > max_z ? z_buffer[x] : max_z;
+    }
+    return max_z;
+}
 
-    float y_min = floorf(fminf(A.y, fminf(B.y, C.y)));
-    float y_max = ceilf(fmaxf(A.y, fmaxf(B.y, C.y)));
+// Texel coordinate c wrapped into [0, size), with a mask when size is a
+// power of two. c / size rounds, so the other sizes clamp what lands a texel
+// out
+static int wrap_texel(float c, unsigned int size, bool pot) {
+    int texel = (int)floorf(c);
+    if (pot) return texel & (size - 1);
+    texel -= (int)size * (int)floorf(c / size);
+    if (texel < 0) return 0;
+    return texel < (int)size ? texel : (int)size - 1;
+}
 
-    float biasA = is_top_left(&B, &C) ? 0 : -0.0001f;
-    float biasB = is_top_left(&C, &A) ? 0 : -0.0001f;
-    float biasC = is_top_left(&A, &B) ? 0 : -0.0001f;
+// Byte offset of texel u, v of level
+static size_t texel_offset(const tex_level_t *level, unsigned int u,
+                           unsigned int v) {
+    size_t tile = (size_t)(v / TEX_TILE_SIZE) * level->tiles_w +
+                  u / TEX_TILE_SIZE;
+    unsigned int texel =
+        v % TEX_TILE_SIZE * TEX_TILE_SIZE + u % TEX_TILE_SIZE;
+    return (tile * TEX_TILE_SIZE * TEX_TILE_SIZE + texel) * 4;
+}
 
-    vec3_t P = {x_min, y_min, 0};
+// Texel u, v of level as its bytes are in memory, r in the low byte
+static uint32_t texel_at(const tex_level_t *level, int u, int v) {
+    uint32_t texel;
+    memcpy(&texel, &level->data[texel_offset(level, u, v)], 4);
+    return texel;
+}
 
-    float wA_row;
-    float wB_row;
-    float wC_row;
+// Texel under u, v, in texels. Bilinear filtering weighs the four texels
+// around it in 8.8 fixed point like the SIMD kernels, the even and odd
+// bytes apart so every product stays in its own 16 bits
+static uint32_t sample_texel(const tex_t *tex, const tex_level_t *level,
+                             float u, float v) {
+    if (tex->filter != TEX_FILTER_BILINEAR) {
+        return texel_at(level, wrap_texel(u, level->w, level->pot),
+                        wrap_texel(v, level->h, level->pot));
+    }
 
-    wA_row = edge_cross(&B, &C, &P) + biasA;
-    wB_row = edge_cross(&C, &A, &P) + biasB;
-    wC_row = edge_cross(&A, &B, &P) + biasC;
+    u -= 0.5f;
+    v -= 0.5f;
+    int u0 = wrap_texel(u, level->w, level->pot);
+    int v0 = wrap_texel(v, level->h, level->pot);
+    int u1 = u0 + 1 < (int)level->w ? u0 + 1 : 0;
+    int v1 = v0 + 1 < (int)level->h ? v0 + 1 : 0;
+    uint32_t taps[4] = {texel_at(level, u0, v0), texel_at(level, u1, v0),
+                        texel_at(level, u0, v1), texel_at(level, u1, v1)};
+
+    uint32_t fu = (u - floorf(u)) * 0x100;
+    uint32_t fv = (v - floorf(v)) * 0x100;
+    uint32_t w11 = (fu * fv) >> 8;
+    uint32_t weights[4] = {0x100 - fu - fv + w11, fu - w11, fv - w11, w11};
+
+    uint32_t even = 0;
+    uint32_t odd = 0;
+    for (int i = 0; i < 4; i++) {
+        even += (taps[i] & 0x00FF00FF) * weights[i];
+        odd += ((taps[i] >> 8) & 0x00FF00FF) * weights[i];
+    }
+    return ((even >> 8) & 0x00FF00FF) | (odd & 0xFF00FF00);
+}
 
-    float delta_wA_col = C.y - B.y;
-    float delta_wB_col = A.y - C.y;
-    float delta_wC_col = B.y - A.y;
+// u/w, v/w and 1/w of the vertices weighed with b
+static vec3_t interpolate_uv(const vec3_t uv[3], const vec3_t *b) {
+    return (vec3_t){b->x * uv[0].x + b->y * uv[1].x + b->z * uv[2].x,
+                    b->x * uv[0].y + b->y * uv[1].y + b->z * uv[2].y,
+                    b->x * uv[0].z + b->y * uv[1].z + b->z * uv[2].z};
+}
 
-    float delta_wA_row = B.x - C.x;
-    float delta_wB_row = C.x - A.x;
-    float delta_wC_row = A.x - B.x;
+void tex_lod_setup(tex_lod_t *lod, const tex_t *tex, const vec3_t uv[3],
+                   const vec3_t *b, const vec3_t *b_dx, const vec3_t *b_dy) {
+    lod->tex = tex;
+    lod->origin = interpolate_uv(uv, b);
+    lod->step_x = interpolate_uv(uv, b_dx);
+    lod->step_y = interpolate_uv(uv, b_dy);
+}
 
-    uint32x4_t biasA4 = vdupq_n_f32(biasA);
-    uint32x4_t biasB4 = vdupq_n_f32(biasB);
-    uint32x4_t biasC4 = vdupq_n_f32(biasC);
+const tex_level_t *tex_lod_level(const tex_lod_t *lod, float x, float y) {
+    const tex_t *tex = lod->tex;
+    if (tex->level_count < 2) return &tex->levels[0];
+
+    const vec3_t *dx = &lod->step_x;
+    const vec3_t *dy = &lod->step_y;
+    float s = lod->origin.x + dx->x * x + dy->x * y;
+    float t = lod->origin.y + dx->y * x + dy->y * y;
+    float q = lod->origin.z + dx->z * x + dy->z * y;
+    if (!(q > 0)) return &tex->levels[0];
+
+    // u = s / q, so du = (ds q - s dq) / q^2, scaled to texels
+    float u_scale = tex->levels[0].w / (q * q);
+    float v_scale = tex->levels[0].h / (q * q);
+    float du_dx = (dx->x * q - s * dx->z) * u_scale;
+    float dv_dx = (dx->y * q - t * dx->z) * v_scale;
+    float du_dy = (dy->x * q - s * dy->z) * u_scale;
+    float dv_dy = (dy->y * q - t * dy->z) * v_scale;
+
+    // the level is log2 of the longer side of the pixel's footprint rounded,
+    // which is half the exponent of its square plus one, rounded down
+    float footprint_sq = fmaxf(du_dx * du_dx + dv_dx * dv_dx,
+                               du_dy * du_dy + dv_dy * dv_dy);
+    if (!(footprint_sq > 1)) return &tex->levels[0];
+    if (!isfinite(footprint_sq))
+        return &tex->levels[tex->level_count - 1];
+    unsigned int level = (ilogbf(footprint_sq) + 1) / 2;
+    if (level >= tex->level_count) level = tex->level_count - 1;
+    return &tex->levels[level];
+}
 
+bool fill_is_opaque(const tex_t *tex, const vec3_t *face_normal,
+                    const vec3_t *directional_light) {
     float lum = vec3_dot(face_normal, directional_light);
     lum = lum / 2 + 0.5;
-    char grey = 0xFF * lum;
-
-    uint32_t color = (int)grey << 24;
-    color += (int)grey << 16;
-    color += (int)grey << 8;
-    color += (int)grey << 0;
-    uint32x4_t color_vec = vdupq_n_u32(color);
-
-    float32x4_t delta_wA_col_vec = vdupq_n_f32(delta_wA_col * 4);
-    float32x4_t delta_wB_col_vec = vdupq_n_f32(delta_wB_col * 4);
-    float32x4_t delta_wC_col_vec = vdupq_n_f32(delta_wC_col * 4);
-
-    float32x4_t delta_wA_row_vec = vdupq_n_f32(delta_wA_row);
-    float32x4_t delta_wB_row_vec = vdupq_n_f32(delta_wB_row);
-    float32x4_t delta_wC_row_vec = vdupq_n_f32(delta_wC_row);
-
-    float32x4_t wA_row_vec;
-    float32x4_t wB_row_vec;
-    float32x4_t wC_row_vec;
-    {
-        float32_t w_row[4] = {wA_row, wA_row + delta_wA_col,
-                              wA_row + delta_wA_col * 2,
-                              wA_row + delta_wA_col * 3};
-        wA_row_vec = vld1q_f32(w_row);
-        w_row[0] = wB_row;
-        w_row[1] = wB_row + delta_wB_col;
-        w_row[2] = wB_row + delta_wB_col * 2;
-        w_row[3] = wB_row + delta_wB_col * 3;
-        wB_row_vec = vld1q_f32(w_row);
-        w_row[0] = wC_row;
-        w_row[1] = wC_row + delta_wC_col;
-        w_row[2] = wC_row + delta_wC_col * 2;
-        w_row[3] = wC_row + delta_wC_col * 3;
-        wC_row_vec = vld1q_f32(w_row);
-    }
-
-    float32x4_t zeros = vdupq_n_f32(0.0);
-    float32x4_t ffs = vdupq_n_u32(0xFF);
-    float inv_area = 1 / area;
-
-    for (int y = y_min; y <= y_max; y++) {
-        float32x4_t wA_vec = duplicate_q_f32(wA_row_vec);
-        float32x4_t wB_vec = duplicate_q_f32(wB_row_vec);
-        float32x4_t wC_vec = duplicate_q_f32(wC_row_vec);
-
-        bool has_been_inside = false;
-        for (int x = x_min; x <= x_max; x += 4) {
-            float32x4_t b_coords_A = vsubq_f32(wA_vec, biasA4);
-            float32x4_t b_coords_B = vsubq_f32(wB_vec, biasB4);
-            float32x4_t b_coords_C = vsubq_f32(wC_vec, biasC4);
-
-            b_coords_A = vmulq_n_f32(b_coords_A, inv_area);
-            b_coords_B = vmulq_n_f32(b_coords_B, inv_area);
-            b_coords_C = vmulq_n_f32(b_coords_C, inv_area);
-
-            // ba * az + bb * bz + bc * cz
-            float32x4_t z_vec = vmulq_n_f32(b_coords_A, A.z);
-            z_vec = vfmaq_n_f32(z_vec, b_coords_B, B.z);
-            z_vec = vfmaq_n_f32(z_vec, b_coords_C, C.z);
-
-            uint32x4_t inside_triangle_vec =
-                vandq_u32(vandq_u32(vcgtq_f32(b_coords_A, zeros),
-                                    vcgtq_f32(b_coords_B, zeros)),
-                          vcgtq_f32(b_coords_C, zeros));
-
-            if (inside_triangle_vec[0] || inside_triangle_vec[1] ||
-                inside_triangle_vec[2] || inside_triangle_vec[3]) {
-                has_been_inside = true;
-                float32x4_t z_buff_vec =
-                    vld1q_f32(&z_buffer[SCREEN_WIDTH * y + x]);
-                uint32x4_t pixel_priority_vec = vcltq_f32(z_vec, z_buff_vec);
-                uint32x4_t fb_vec =
-                    vld1q_u32(&frame_buffer[SCREEN_WIDTH * y + x]);
-
-                if (has_tex) {
-                    float32x4_t u_vec = vmulq_n_f32(b_coords_A, ABC_uv[0].x);
-                    u_vec = vfmaq_n_f32(u_vec, b_coords_B, ABC_uv[1].x);
-                    u_vec = vfmaq_n_f32(u_vec, b_coords_C, ABC_uv[2].x);
-                    float32x4_t v_vec = vmulq_n_f32(b_coords_A, ABC_uv[0].y);
-                    v_vec = vfmaq_n_f32(v_vec, b_coords_B, ABC_uv[1].y);
-                    v_vec = vfmaq_n_f32(v_vec, b_coords_C, ABC_uv[2].y);
-                    float32x4_t w_vec = vmulq_n_f32(b_coords_A, ABC_uv[0].z);
-                    w_vec = vfmaq_n_f32(w_vec, b_coords_B, ABC_uv[1].z);
-                    w_vec = vfmaq_n_f32(w_vec, b_coords_C, ABC_uv[2].z);
-
-                    float32x4_t width4 = vdupq_n_f32(tex->w);
-                    u_vec = vdivq_f32(u_vec, w_vec);
-                    u_vec = vmulq_n_f32(u_vec, tex->w);
-                    int32x4_t u_coord_vec = vcvtq_s32_f32(vrndmq_f32(u_vec));
-                    u_coord_vec = vsubq_s32(
-                        u_coord_vec, vmulq_n_s32(vcvtq_s32_f32(vrndmq_f32(
-                                                     vdivq_f32(u_vec, width4))),
-                                                 tex->w));
-
-                    float32x4_t height4 = vdupq_n_f32(tex->h);
-                    v_vec = vdivq_f32(v_vec, w_vec);
-                    v_vec = vmulq_n_f32(v_vec, tex->h);
-                    int32x4_t v_coord_vec = vcvtq_s32_f32(vrndmq_f32(v_vec));
-                    v_coord_vec =
-                        vsubq_s32(v_coord_vec,
-                                  vmulq_n_s32(vcvtq_s32_f32(vrndmq_f32(
-                                                  vdivq_f32(v_vec, height4))),
-                                              tex->h));
-
-                    int32x4_t tex_coord_vec = vmulq_n_f32(
-                        vmlaq_n_s32(u_coord_vec, v_coord_vec, tex->w), 4);
-
-#ifdef LITTLE_ENDIAN
-
-                    int idx0 = tex_coord_vec[0];
-                    int idx1 = tex_coord_vec[1];
-                    int idx2 = tex_coord_vec[2];
-                    int idx3 = tex_coord_vec[3];
-
-                    uint8x8_t rgba_1_2 = vld1_u8(&tex->data[idx0]);
-                    rgba_1_2[4] = tex->data[idx1 + 0];
-                    rgba_1_2[5] = tex->data[idx1 + 1];
-                    rgba_1_2[6] = tex->data[idx1 + 2];
-                    rgba_1_2[7] = tex->data[idx1 + 3];
-
-                    float16x8_t rgba_1_2f = vcvtq_f16_u16(vmovl_u8(rgba_1_2));
-                    rgba_1_2f = vmulq_n_f16(rgba_1_2f, lum);
-                    rgba_1_2 = vmovn_u16(vcvtq_u16_f16(rgba_1_2f));
-
-                    uint8x8_t rgba_3_4 = vld1_u8(&tex->data[idx2]);
-                    rgba_3_4[4] = tex->data[idx3 + 0];
-                    rgba_3_4[5] = tex->data[idx3 + 1];
-                    rgba_3_4[6] = tex->data[idx3 + 2];
-                    rgba_3_4[7] = tex->data[idx3 + 3];
-
-                    float16x8_t rgba_3_4f = vcvtq_f16_u16(vmovl_u8(rgba_3_4));
-                    rgba_3_4f = vmulq_n_f16(rgba_3_4f, lum);
-                    rgba_3_4 = vmovn_u16(vcvtq_u16_f16(rgba_3_4f));
-
-                    uint8x16_t rgba_vec_8 = vcombine_u8(rgba_1_2, rgba_3_4);
-
-                    rgba_vec_8 = vrev32q_u8(rgba_vec_8);
-
-#endif // little endian
-
-                    uint32x4_t rgba_vec_32;
-                    rgba_vec_32 = vreinterpretq_u32_u8(rgba_vec_8);
-                    color_vec = rgba_vec_32;
-                }
-
-                uint32x4_t is_transparent =
-                    vcgtq_u32(vandq_u32(color_vec, ffs), zeros);
+    if (!(lum > 0)) return false;
 
-                uint32x4_t mask =
-                    vandq_u32(inside_triangle_vec, pixel_priority_vec);
+    // the SIMD kernels scale by lum in 8.8 fixed point, which rounds down the
+    // most, the untextured color is white
+    unsigned int alpha = tex ? tex->min_alpha : 0xFF;
+    return alpha * (unsigned int)(fminf(lum, 1) * 0x100) >= 0x100;
+}
 
-                mask = vandq_u32(mask, is_transparent);
+unsigned int fill_triangle_scalar(uint32_t *frame_buffer, float *z_buffer,
+                                  const vec3_t ABC[3], const vec3_t ABC_uv[3],
+                                  const vec3_t *face_normal,
+                                  const vec3_t *directional_light,
+                                  const tex_t *tex, const rect_t *clip,
+                                  fill_mode_t mode) {
+    bool has_tex = ABC_uv && tex;
+    unsigned int passed = 0;
+
+    vec3_t vertices[3] = {ABC[0], ABC[1], ABC[2]};
+    fixed_point_t fixed[3];
+    for (int i = 0; i < 3; i++) {
+        // weights come from the snapped vertices too so they match coverage
+        fixed[i] = snap(&ABC[i]);
+        vertices[i].x = (float)fixed[i].x / SUBPIXEL_ONE;
+        vertices[i].y = (float)fixed[i].y / SUBPIXEL_ONE;
+    }
 
-                uint32x4_t new_fb_vec = vbslq_u32(mask, color_vec, fb_vec);
-                z_buff_vec = vbslq_u32(mask, z_vec, z_buff_vec);
+    const vec3_t *A = &vertices[0];
+    const vec3_t *B = &vertices[1];
+    const vec3_t *C = &vertices[2];
+    const fixed_point_t *A_fixed = &fixed[0];
+    const fixed_point_t *B_fixed = &fixed[1];
+    const fixed_point_t *C_fixed = &fixed[2];
+    const vec3_t *A_uv = has_tex ? &ABC_uv[0] : NULL;
+    const vec3_t *B_uv = has_tex ? &ABC_uv[1] : NULL;
+    const vec3_t *C_uv = has_tex ? &ABC_uv[2] : NULL;
 
-                vst1q_u32(&frame_buffer[SCREEN_WIDTH * y + x], new_fb_vec);
-                vst1q_f32(&z_buffer[SCREEN_WIDTH * y + x], z_buff_vec);
-            } else if (has_been_inside) {
-                x = x_max + 1;
-            }
+    int64_t area_fixed = edge_cross(A_fixed, B_fixed, C_fixed);
+    if (area_fixed == 0) return 0;
 
-            wA_vec = vaddq_f32(wA_vec, delta_wA_col_vec);
-            wB_vec = vaddq_f32(wB_vec, delta_wB_col_vec);
-            wC_vec = vaddq_f32(wC_vec, delta_wC_col_vec);
-        }
-        wA_row_vec = vaddq_f32(wA_row_vec, delta_wA_row_vec);
-        wB_row_vec = vaddq_f32(wB_row_vec, delta_wB_row_vec);
-        wC_row_vec = vaddq_f32(wC_row_vec, delta_wC_row_vec);
-    }
-}
-#else
-
-static void fill_triangle(uint32_t *frame_buffer, float *z_buffer,
-                          const vec3_t *A, const vec3_t *A_uv, const vec3_t *B,
-                          const vec3_t *B_uv, const vec3_t *C,
-                          const vec3_t *C_uv, const vec3_t *face_normal,
-                          const vec3_t *directional_light, const tex_t *tex) {
-    bool has_tex = A_uv != NULL && B_uv != NULL && C_uv != NULL;
-    has_tex = has_tex && tex;
-
-    bool clockwise = false;
-    // Area of parallelogram
-    float area = edge_cross(A, B, C);
-    if (area < 0) clockwise = true;
-
-    if (clockwise) {
+    if (area_fixed < 0) {
         const vec3_t *B_new = C;
         const vec3_t *C_new = B;
         B = B_new;
         C = C_new;
 
-        area = edge_cross(A, B, C);
+        const fixed_point_t *B_fixed_new = C_fixed;
+        C_fixed = B_fixed;
+        B_fixed = B_fixed_new;
 
         if (has_tex) {
             B_new = C_uv;
@@ -289,6 +228,7 @@ static void fill_triangle(uint32_t *frame_buffer, float *z_buffer,
             C_uv = C_new;
         }
     }
+    float area = edge_cross_float(A, B, C);
 
     float x_min = floorf(fminf(A->x, fminf(B->x, C->x)));
     float x_max = ceilf(fmaxf(A->x, fmaxf(B->x, C->x)));
@@ -296,19 +236,36 @@ static void fill_triangle(uint32_t *frame_buffer, float *z_buffer,
     float y_min = floorf(fminf(A->y, fminf(B->y, C->y)));
     float y_max = ceilf(fmaxf(A->y, fmaxf(B->y, C->y)));
 
-    float biasA = is_top_left(B, C) ? 0 : -0.0001f;
-    float biasB = is_top_left(C, A) ? 0 : -0.0001f;
-    float biasC = is_top_left(A, B) ? 0 : -0.0001f;
-
+    x_min = fmaxf(x_min, clip->x_min);
+    y_min = fmaxf(y_min, clip->y_min);
+    x_max = fminf(x_max, clip->x_max);
+    y_max = fminf(y_max, clip->y_max);
+
+    // exact integer edge functions decide coverage, biased by one where an
+    // edge is not top left so a pixel on it is left to the neighbour
+    fixed_point_t P_fixed = {(int32_t)x_min * SUBPIXEL_ONE,
+                             (int32_t)y_min * SUBPIXEL_ONE};
+    int64_t eA_origin = edge_cross(B_fixed, C_fixed, &P_fixed) -
+                     !is_top_left(B_fixed, C_fixed);
+    int64_t eB_origin = edge_cross(C_fixed, A_fixed, &P_fixed) -
+                     !is_top_left(C_fixed, A_fixed);
+    int64_t eC_origin = edge_cross(A_fixed, B_fixed, &P_fixed) -
+                     !is_top_left(A_fixed, B_fixed);
+
+    int64_t delta_eA_col = (int64_t)(C_fixed->y - B_fixed->y) * SUBPIXEL_ONE;
+    int64_t delta_eB_col = (int64_t)(A_fixed->y - C_fixed->y) * SUBPIXEL_ONE;
+    int64_t delta_eC_col = (int64_t)(B_fixed->y - A_fixed->y) * SUBPIXEL_ONE;
+
+    int64_t delta_eA_row = (int64_t)(B_fixed->x - C_fixed->x) * SUBPIXEL_ONE;
+    int64_t delta_eB_row = (int64_t)(C_fixed->x - A_fixed->x) * SUBPIXEL_ONE;
+    int64_t delta_eC_row = (int64_t)(A_fixed->x - B_fixed->x) * SUBPIXEL_ONE;
+
+    // and the float ones only weigh the attributes
     vec3_t P = {x_min, y_min, 0};
 
-    float wA_row;
-    float wB_row;
-    float wC_row;
-
-    wA_row = edge_cross(B, C, &P) + biasA;
-    wB_row = edge_cross(C, A, &P) + biasB;
-    wC_row = edge_cross(A, B, &P) + biasC;
+    float wA_origin = edge_cross_float(B, C, &P);
+    float wB_origin = edge_cross_float(C, A, &P);
+    float wC_origin = edge_cross_float(A, B, &P);
 
     float delta_wA_col = C->y - B->y;
     float delta_wB_col = A->y - C->y;
@@ -318,102 +275,169 @@ static void fill_triangle(uint32_t *frame_buffer, float *z_buffer,
     float delta_wB_row = C->x - A->x;
     float delta_wC_row = A->x - B->x;
 
-    // TODO: Apply good simd here (plan it)
-    for (int y = y_min; y <= y_max; y++) {
-        float wA = wA_row;
-        float wB = wB_row;
-        float wC = wC_row;
-
-        bool has_been_inside = false;
-
-        for (int x = x_min; x <= x_max; x++) {
-            bool inside_triangle = wA >= 0 && wB >= 0 && wC >= 0;
+    tex_lod_t lod;
+    if (has_tex) {
+        vec3_t uv[3] = {*A_uv, *B_uv, *C_uv};
+        vec3_t b = {wA_origin / area, wB_origin / area, wC_origin / area};
+        vec3_t b_dx = {delta_wA_col / area, delta_wB_col / area,
+                       delta_wC_col / area};
+        vec3_t b_dy = {delta_wA_row / area, delta_wB_row / area,
+                       delta_wC_row / area};
+        tex_lod_setup(&lod, tex, uv, &b, &b_dx, &b_dy);
+    }
 
-            vec3_t b_coords;
-            float z;
-            bool has_pixel_priority = false;
-            if (inside_triangle) {
-                b_coords = (vec3_t){(wA - biasA) / area, (wB - biasB) / area,
-                                    (wC - biasC) / area};
-                // use this z coord when/if i change to fixed point
-                /* z = b_coords.x / A->z + b_coords.y / B->z + b_coords.z /
-                 * C->z; */
-                /* z = 1 / z; */
+    // walk the bounding box in blocks, skip the ones an edge leaves out
+    // entirely and drop the edge tests in the ones no edge goes through
+    int x_first = (int)x_min - (int)x_min % RASTER_BLOCK_SIZE;
+    int y_first = (int)y_min - (int)y_min % RASTER_BLOCK_SIZE;
+    for (int block_y = y_first; block_y <= y_max;
+         block_y += RASTER_BLOCK_SIZE) {
+        int y0 = fmaxf(block_y, y_min);
+        int y1 = fminf(block_y + RASTER_BLOCK_SIZE - 1, y_max);
 
-                z = b_coords.x * A->z + b_coords.y * B->z + b_coords.z * C->z;
+        bool has_been_inside = false;
 
-                has_pixel_priority = pixel_priority(z_buffer, x, y, z);
+        for (int block_x = x_first; block_x <= x_max;
+             block_x += RASTER_BLOCK_SIZE) {
+            int x0 = fmaxf(block_x, x_min);
+            int x1 = fminf(block_x + RASTER_BLOCK_SIZE - 1, x_max);
+
+            int64_t dx = x0 - (int)x_min;
+            int64_t dy = y0 - (int)y_min;
+            int64_t eA_row = eA_origin + delta_eA_col * dx + delta_eA_row * dy;
+            int64_t eB_row = eB_origin + delta_eB_col * dx + delta_eB_row * dy;
+            int64_t eC_row = eC_origin + delta_eC_col * dx + delta_eC_row * dy;
+
+            cover_t cover = min_cover(
+                min_cover(edge_cover(eA_row, delta_eA_col * (x1 - x0),
+                                     delta_eA_row * (y1 - y0)),
+                          edge_cover(eB_row, delta_eB_col * (x1 - x0),
+                                     delta_eB_row * (y1 - y0))),
+                edge_cover(eC_row, delta_eC_col * (x1 - x0),
+                           delta_eC_row * (y1 - y0)));
+
+            // the blocks a convex triangle covers in a row of blocks are
+            // next to each other
+            if (cover == COVER_NONE) {
+                if (has_been_inside) break;
+                continue;
             }
+            has_been_inside = true;
 
-            if (inside_triangle && has_pixel_priority) {
-                has_been_inside = true;
-                float lum = vec3_dot(face_normal, directional_light);
-                lum = lum / 2 + 0.5;
-
-                uint32_t color;
-                uint32_t a, r, g, b;
-
-                if (has_tex) {
-                    float u = b_coords.x * A_uv->x + b_coords.y * B_uv->x +
-                              b_coords.z * C_uv->x;
-                    float v = b_coords.x * A_uv->y + b_coords.y * B_uv->y +
-                              b_coords.z * C_uv->y;
-                    float w = b_coords.x * A_uv->z + b_coords.y * B_uv->z +
-                              b_coords.z * C_uv->z;
-
-                    float w_inv = 1 / w;
-                    int u_coord = tex->w * u * w_inv;
-                    u_coord = u_coord - (tex->w * (u_coord / tex->w));
-                    /* int u_coord = (int)(tex->w * u * w_inv) % tex->w; */
-                    /* u_coord = u_coord - (tex->w * (u_coord / tex->w)); */
-
-                    /* u_coord = u_coord >= 0 ? u_coord : u_coord + tex->w; */
-
-                    v = tex->h * v * w_inv;
-                    int v_coord = (int)floorf(v);
-                    v_coord = v_coord - (tex->h * (int)floorf(v / tex->h));
-                    /* int v_coord = (int)(tex->h * v * w_inv) % tex->h; */
-                    /* v_coord = v_coord >= 0 ? v_coord : v_coord + tex->h; */
-
-                    int tex_cord_pos = (v_coord * tex->w + u_coord) * 4;
-                    r = tex->data[tex_cord_pos + 0];
-                    g = tex->data[tex_cord_pos + 1];
-                    b = tex->data[tex_cord_pos + 2];
-                    a = tex->data[tex_cord_pos + 3];
-                } else {
-                    color = (uint32_t)0xFFFFFFFF;
-                    /* color = 0xCCCCCCFF; */
-                    a = 0xFF & (color >> 24);
-                    r = 0xFF & (color >> 16);
-                    g = 0xFF & (color >> 8);
-                    b = 0xFF & (color >> 0);
-                }
-
-                r = (int)(r * lum) << 24;
-                g = (int)(g * lum) << 16;
-                b = (int)(b * lum) << 8;
-                a = (int)(a * lum) << 0;
+            float wA_row = wA_origin + delta_wA_col * dx + delta_wA_row * dy;
+            float wB_row = wB_origin + delta_wB_col * dx + delta_wB_row * dy;
+            float wC_row = wC_origin + delta_wC_col * dx + delta_wC_row * dy;
 
-                color = r + g + b + a;
+            // one mip level for the block, picked at its center
+            const tex_level_t *level = NULL;
+            if (has_tex) {
+                level = tex_lod_level(&lod, dx + (x1 - x0) / 2.0f,
+                                      dy + (y1 - y0) / 2.0f);
+            }
 
-                if (a != 0) {
-                    frame_buffer[SCREEN_WIDTH * y + x] = color;
-                    z_buffer[SCREEN_WIDTH * y + x] = z;
+            for (int y = y0; y <= y1; y++) {
+                float wA = wA_row;
+                float wB = wB_row;
+                float wC = wC_row;
+                int64_t eA = eA_row;
+                int64_t eB = eB_row;
+                int64_t eC = eC_row;
+
+                for (int x = x0; x <= x1; x++) {
+                    bool inside_triangle = cover == COVER_FULL ||
+                                           (eA >= 0 && eB >= 0 && eC >= 0);
+
+                    vec3_t b_coords;
+                    float z;
+                    bool has_pixel_priority = false;
+                    if (inside_triangle) {
+                        b_coords = (vec3_t){wA / area, wB / area, wC / area};
+                        // use this z coord when/if i change to fixed point
+                        /* z = b_coords.x / A->z + b_coords.y / B->z +
+                         * b_coords.z / C->z; */
+                        /* z = 1 / z; */
+
+                        z = b_coords.x * A->z + b_coords.y * B->z +
+                            b_coords.z * C->z;
+
+                        has_pixel_priority =
+                            mode == FILL_EQUAL_DEPTH
+                                ? z_buffer[SCREEN_WIDTH * y + x] == z
+                                : pixel_priority(z_buffer, x, y, z);
+                    }
+
+                    if (inside_triangle && has_pixel_priority &&
+                        mode == FILL_DEPTH) {
+                        passed++;
+                        z_buffer[SCREEN_WIDTH * y + x] = z;
+                    } else if (inside_triangle && has_pixel_priority) {
+                        passed++;
+                        float lum = vec3_dot(face_normal, directional_light);
+                        lum = lum / 2 + 0.5;
+
+                        uint32_t color;
+                        uint32_t a, r, g, b;
+
+                        if (has_tex) {
+                            float u = b_coords.x * A_uv->x +
+                                      b_coords.y * B_uv->x +
+                                      b_coords.z * C_uv->x;
+                            float v = b_coords.x * A_uv->y +
+                                      b_coords.y * B_uv->y +
+                                      b_coords.z * C_uv->y;
+                            float w = b_coords.x * A_uv->z +
+                                      b_coords.y * B_uv->z +
+                                      b_coords.z * C_uv->z;
+
+                            float w_inv = 1 / w;
+                            uint32_t texel = sample_texel(
+                                tex, level, level->w * u * w_inv,
+                                level->h * v * w_inv);
+                            r = texel & 0xFF;
+                            g = (texel >> 8) & 0xFF;
+                            b = (texel >> 16) & 0xFF;
+                            a = texel >> 24;
+                        } else {
+                            color = (uint32_t)0xFFFFFFFF;
+                            /* color = 0xCCCCCCFF; */
+                            a = 0xFF & (color >> 24);
+                            r = 0xFF & (color >> 16);
+                            g = 0xFF & (color >> 8);
+                            b = 0xFF & (color >> 0);
+                        }
+
+                        r = (int)(r * lum) << 24;
+                        g = (int)(g * lum) << 16;
+                        b = (int)(b * lum) << 8;
+                        a = (int)(a * lum) << 0;
+
+                        color = r + g + b + a;
+
+                        if (a != 0) {
+                            frame_buffer[SCREEN_WIDTH * y + x] = color;
+                            if (mode == FILL_SHADE)
+                                z_buffer[SCREEN_WIDTH * y + x] = z;
+                        }
+                    }
+
+                    wA += delta_wA_col;
+                    wB += delta_wB_col;
+                    wC += delta_wC_col;
+                    eA += delta_eA_col;
+                    eB += delta_eB_col;
+                    eC += delta_eC_col;
                 }
-            } else if (has_been_inside && !inside_triangle) {
-                x = x_max + 1;
+                wA_row += delta_wA_row;
+                wB_row += delta_wB_row;
+                wC_row += delta_wC_row;
+                eA_row += delta_eA_row;
+                eB_row += delta_eB_row;
+                eC_row += delta_eC_row;
             }
-
-            wA += delta_wA_col;
-            wB += delta_wB_col;
-            wC += delta_wC_col;
         }
-        wA_row += delta_wA_row;
-        wB_row += delta_wB_row;
-        wC_row += delta_wC_row;
     }
+    return passed;
 }
-#endif // arm neon
 
 // TODO: Change to bresenham's if too slow
 void draw_line(bool *wireframe_buffer, const vec3_t *A, const vec3_t *B) {
@@ -440,7 +464,10 @@ void draw_line(bool *wireframe_buffer, const vec3_t *A, const vec3_t *B) {
     while (!after_x && !after_y) {
         int y_int = (y > (floorf(y) + 0.5f)) ? ceilf(y) : floorf(y);
         int x_int = (x > (floorf(x) + 0.5f)) ? ceilf(x) : floorf(x);
-        wireframe_buffer[WINDOW_WIDTH * y_int + x_int] = true;
+        // lines of triangles in the guard band run off the screen
+        if (x_int >= 0 && x_int < SCREEN_WIDTH && y_int >= 0 &&
+            y_int < SCREEN_HEIGHT)
+            wireframe_buffer[WINDOW_WIDTH * y_int + x_int] = true;
         x += x_step;
         y += y_step;
 
@@ -465,17 +492,11 @@ void draw_triangle(state_t *state, const vec3_t A, const vec3_t *A_uv,
     switch (state->flags.render_flag) {
     case FRAME_BUFFER:
     case Z_BUFFER:
-#ifdef __ARM_NEON__
-        fill_triangle_fast(
-            state->buffers.frame_buffer, state->buffers.z_buffer,
-            (vec3_t[3]){A, B, C},
+        // rasterized by the tile workers in flush_tile_bins
+        bin_triangle(
+            state->tile_bins, (vec3_t[3]){A, B, C},
             A_uv && B_uv && C_uv ? (vec3_t[3]){*A_uv, *B_uv, *C_uv} : NULL,
-            &face_normal, &state->engine->directional_light, tex);
-#else
-        fill_triangle(state->buffers.frame_buffer, state->buffers.z_buffer, &A,
-                      A_uv, &B, B_uv, &C, C_uv, &face_normal,
-                      &state->engine->directional_light, tex);
-#endif
+            &face_normal, tex);
         break;
 
     case WIREFRAME:
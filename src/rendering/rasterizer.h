@@ -15,4 +15,95 @@ void draw_triangle(state_t *state,
                    const tex_t *tex);
 void draw_mesh(state_t *state, const mesh_t *mesh);
 
+// Inclusive pixel bounds a fill kernel may write to
+typedef struct {
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+} rect_t;
+
+// Vertices are snapped to 28.4 fixed point, a 16th of a pixel, and coverage
+// is decided on exact integer edge functions over it
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// Side of the blocks the fill kernels classify against the edges before
+// touching pixels, wide kernels make theirs a vector wide
+#define RASTER_BLOCK_SIZE 8
+
+// What a fill kernel does with the pixels of a triangle. The depth pre-pass
+// runs FILL_DEPTH over the opaque triangles first, then shades them with
+// FILL_EQUAL_DEPTH, so each visible pixel is shaded once
+typedef enum {
+    // nearer pixels get shaded and their depth written
+    FILL_SHADE,
+    // nearer pixels only get their depth written
+    FILL_DEPTH,
+    // pixels at exactly the depth in the z buffer get shaded
+    FILL_EQUAL_DEPTH,
+} fill_mode_t;
+
+#define FILL_TRIANGLE_PARAMS                                                   \
+    uint32_t *frame_buffer, float *z_buffer, const vec3_t ABC[3],              \
+        const vec3_t ABC_uv[3], const vec3_t *face_normal,                     \
+        const vec3_t *directional_light, const tex_t *tex,                     \
+        const rect_t *clip, fill_mode_t mode
+
+// Bound by init_cpu_dispatch to the fastest kernel the CPU can run, returns
+// how many pixels passed the depth test. The z buffer holds the same depth
+// for a triangle whichever mode drew it, so FILL_EQUAL_DEPTH finds exactly
+// the pixels FILL_DEPTH left
+typedef unsigned int (*fill_triangle_fn)(FILL_TRIANGLE_PARAMS);
+extern fill_triangle_fn fill_triangle;
+
+unsigned int fill_triangle_scalar(FILL_TRIANGLE_PARAMS);
+
+// s = u/w, t = v/w and q = 1/w of a textured triangle as planes over the
+// screen, to pick mip levels with
+typedef struct {
+    const tex_t *tex;
+    vec3_t origin;
+    vec3_t step_x;
+    vec3_t step_y;
+} tex_lod_t;
+
+// b holds the barycentric coordinates of the triangle at the origin and b_dx,
+// b_dy their steps per pixel right and down, uv the u/w, v/w and 1/w of the
+// vertices
+void tex_lod_setup(tex_lod_t *lod, const tex_t *tex, const vec3_t uv[3],
+                   const vec3_t *b, const vec3_t *b_dx, const vec3_t *b_dy);
+// Mip level whose texels come closest to the pixels around x, y from the
+// origin
+const tex_level_t *tex_lod_level(const tex_lod_t *lod, float x, float y);
+
+// False when the texture or the light can make an alpha of 0, which leaves
+// the pixel and its depth untouched, such triangles can't go through the
+// depth pre-pass
+bool fill_is_opaque(const tex_t *tex, const vec3_t *face_normal,
+                    const vec3_t *directional_light);
+
+// Side of the z buffer blocks the hierarchical z keeps a bound for
+#define HIZ_BLOCK_SIZE 8
+
+// Farthest depth of the block whose top left pixel is at z_buffer, bound by
+// init_cpu_dispatch too
+extern float (*block_max_z)(const float *z_buffer);
+
+float block_max_z_scalar(const float *z_buffer);
+float block_max_z_sse41(const float *z_buffer);
+float block_max_z_avx2(const float *z_buffer);
+float block_max_z_neon(const float *z_buffer);
+
+// Kernels built from rasterizer_simd.h, one set per backend
+#define DECLARE_SIMD_KERNELS(suffix)                                           \
+    unsigned int fill_triangle_##suffix(FILL_TRIANGLE_PARAMS);                 \
+    void clear_framebuffer_##suffix(uint32_t *frame_buffer, uint32_t color);   \
+    void clear_zbuffer_##suffix(float *z_buffer);
+
+DECLARE_SIMD_KERNELS(sse41)
+DECLARE_SIMD_KERNELS(avx2)
+DECLARE_SIMD_KERNELS(avx512)
+DECLARE_SIMD_KERNELS(neon)
+
 #endif
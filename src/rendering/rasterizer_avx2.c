@@ -0,0 +1,107 @@
+#include "rasterizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// 8 pixels per step
+#define SIMD_WIDTH 8
+#define SIMD_TARGET __attribute__((target("avx2,fma")))
+#define SIMD_INLINE static inline __attribute__((always_inline)) SIMD_TARGET
+#define SIMD_SUFFIX avx2
+
+typedef __m256 vf_t;
+typedef __m256i vi_t;
+typedef __m256i vm_t;
+
+SIMD_INLINE vf_t vf_set1(float f) { return _mm256_set1_ps(f); }
+SIMD_INLINE vf_t vf_lanes(void) {
+    return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+}
+SIMD_INLINE vf_t vf_load(const float *p) { return _mm256_loadu_ps(p); }
+SIMD_INLINE void vf_store(float *p, vf_t a) { _mm256_storeu_ps(p, a); }
+SIMD_INLINE vf_t vf_add(vf_t a, vf_t b) { return _mm256_add_ps(a, b); }
+SIMD_INLINE vf_t vf_sub(vf_t a, vf_t b) { return _mm256_sub_ps(a, b); }
+SIMD_INLINE vf_t vf_mul(vf_t a, vf_t b) { return _mm256_mul_ps(a, b); }
+SIMD_INLINE vf_t vf_div(vf_t a, vf_t b) { return _mm256_div_ps(a, b); }
+// approximate 1 / a, to 12 bits or better
+SIMD_INLINE vf_t vf_rcp(vf_t a) { return _mm256_rcp_ps(a); }
+// a * b + c
+SIMD_INLINE vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) {
+    return _mm256_fmadd_ps(a, b, c);
+}
+SIMD_INLINE vf_t vf_floor(vf_t a) { return _mm256_floor_ps(a); }
+SIMD_INLINE vf_t vf_max(vf_t a, vf_t b) { return _mm256_max_ps(a, b); }
+// max of the 8 lanes, folded down to one 128 bit half first
+SIMD_INLINE float vf_hmax(vf_t a) {
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(a),
+                          _mm256_extractf128_ps(a, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+SIMD_INLINE vi_t vf_to_vi(vf_t a) { return _mm256_cvttps_epi32(a); }
+SIMD_INLINE vm_t vf_cmpge(vf_t a, vf_t b) {
+    return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GE_OQ));
+}
+SIMD_INLINE vm_t vf_cmplt(vf_t a, vf_t b) {
+    return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ));
+}
+SIMD_INLINE vf_t vf_select(vm_t m, vf_t a, vf_t b) {
+    return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(m));
+}
+
+SIMD_INLINE vi_t vi_set1(uint32_t i) { return _mm256_set1_epi32(i); }
+SIMD_INLINE vi_t vi_set1_16(uint16_t i) { return _mm256_set1_epi16(i); }
+SIMD_INLINE vi_t vi_load(const uint32_t *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+SIMD_INLINE void vi_store(uint32_t *p, vi_t a) {
+    _mm256_storeu_si256((__m256i *)p, a);
+}
+SIMD_INLINE vi_t vi_add(vi_t a, vi_t b) { return _mm256_add_epi32(a, b); }
+SIMD_INLINE vi_t vi_sub(vi_t a, vi_t b) { return _mm256_sub_epi32(a, b); }
+SIMD_INLINE vi_t vi_mullo(vi_t a, vi_t b) { return _mm256_mullo_epi32(a, b); }
+SIMD_INLINE vi_t vi_and(vi_t a, vi_t b) { return _mm256_and_si256(a, b); }
+// shifts zeros in
+SIMD_INLINE vi_t vi_srli(vi_t a, int n) { return _mm256_srli_epi32(a, n); }
+SIMD_INLINE vi_t vi_min(vi_t a, vi_t b) { return _mm256_min_epi32(a, b); }
+SIMD_INLINE vi_t vi_max(vi_t a, vi_t b) { return _mm256_max_epi32(a, b); }
+SIMD_INLINE vm_t vi_cmpgt(vi_t a, vi_t b) { return _mm256_cmpgt_epi32(a, b); }
+SIMD_INLINE vi_t vi_select(vm_t m, vi_t a, vi_t b) {
+    return _mm256_blendv_epi8(b, a, m);
+}
+
+// masked off lanes are not loaded at all
+SIMD_INLINE vi_t vi_gather(const uint32_t *base, vi_t idx, vm_t m) {
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                       (const int *)base, idx, m, 4);
+}
+
+// byte swap every lane, 0xAABBGGRR -> 0xRRGGBBAA
+SIMD_INLINE vi_t vi_bswap(vi_t a) {
+    return _mm256_shuffle_epi8(
+        a, _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13,
+                            12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14,
+                            13, 12));
+}
+
+// every byte times a 8.8 fixed point factor, unpack and pack both work per
+// 128 bit half so the lane order comes back unchanged
+SIMD_INLINE vi_t vi_scale_bytes(vi_t a, vi_t factor) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), factor);
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), factor);
+    return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                               _mm256_srli_epi16(hi, 8));
+}
+
+SIMD_INLINE vm_t vm_and(vm_t a, vm_t b) { return _mm256_and_si256(a, b); }
+SIMD_INLINE bool vm_any(vm_t m) { return !_mm256_testz_si256(m, m); }
+SIMD_INLINE unsigned int vm_count(vm_t m) {
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+}
+
+#include "rasterizer_simd.h"
+
+#endif // x86
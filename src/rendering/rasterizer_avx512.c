@@ -0,0 +1,96 @@
+#include "rasterizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// 16 pixels per step, lane masks live in k registers
+#define SIMD_WIDTH 16
+#define SIMD_SUFFIX avx512
+#define SIMD_TARGET __attribute__((target("avx512f,avx512bw")))
+#define SIMD_INLINE static inline __attribute__((always_inline)) SIMD_TARGET
+
+typedef __m512 vf_t;
+typedef __m512i vi_t;
+typedef __mmask16 vm_t;
+
+SIMD_INLINE vf_t vf_set1(float f) { return _mm512_set1_ps(f); }
+SIMD_INLINE vf_t vf_lanes(void) {
+    return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                          15);
+}
+SIMD_INLINE vf_t vf_load(const float *p) { return _mm512_loadu_ps(p); }
+SIMD_INLINE void vf_store(float *p, vf_t a) { _mm512_storeu_ps(p, a); }
+SIMD_INLINE vf_t vf_add(vf_t a, vf_t b) { return _mm512_add_ps(a, b); }
+SIMD_INLINE vf_t vf_sub(vf_t a, vf_t b) { return _mm512_sub_ps(a, b); }
+SIMD_INLINE vf_t vf_mul(vf_t a, vf_t b) { return _mm512_mul_ps(a, b); }
+SIMD_INLINE vf_t vf_div(vf_t a, vf_t b) { return _mm512_div_ps(a, b); }
+// approximate 1 / a, to 12 bits or better
+SIMD_INLINE vf_t vf_rcp(vf_t a) { return _mm512_rcp14_ps(a); }
+// a * b + c
+SIMD_INLINE vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) {
+    return _mm512_fmadd_ps(a, b, c);
+}
+SIMD_INLINE vf_t vf_floor(vf_t a) {
+    return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+SIMD_INLINE vi_t vf_to_vi(vf_t a) { return _mm512_cvttps_epi32(a); }
+SIMD_INLINE vm_t vf_cmpge(vf_t a, vf_t b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);
+}
+SIMD_INLINE vm_t vf_cmplt(vf_t a, vf_t b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+}
+SIMD_INLINE vf_t vf_select(vm_t m, vf_t a, vf_t b) {
+    return _mm512_mask_blend_ps(m, b, a);
+}
+
+SIMD_INLINE vi_t vi_set1(uint32_t i) { return _mm512_set1_epi32(i); }
+SIMD_INLINE vi_t vi_set1_16(uint16_t i) { return _mm512_set1_epi16(i); }
+SIMD_INLINE vi_t vi_load(const uint32_t *p) { return _mm512_loadu_si512(p); }
+SIMD_INLINE void vi_store(uint32_t *p, vi_t a) { _mm512_storeu_si512(p, a); }
+SIMD_INLINE vi_t vi_add(vi_t a, vi_t b) { return _mm512_add_epi32(a, b); }
+SIMD_INLINE vi_t vi_sub(vi_t a, vi_t b) { return _mm512_sub_epi32(a, b); }
+SIMD_INLINE vi_t vi_mullo(vi_t a, vi_t b) { return _mm512_mullo_epi32(a, b); }
+SIMD_INLINE vi_t vi_and(vi_t a, vi_t b) { return _mm512_and_si512(a, b); }
+// shifts zeros in
+SIMD_INLINE vi_t vi_srli(vi_t a, int n) { return _mm512_srli_epi32(a, n); }
+SIMD_INLINE vi_t vi_min(vi_t a, vi_t b) { return _mm512_min_epi32(a, b); }
+SIMD_INLINE vi_t vi_max(vi_t a, vi_t b) { return _mm512_max_epi32(a, b); }
+SIMD_INLINE vm_t vi_cmpgt(vi_t a, vi_t b) {
+    return _mm512_cmpgt_epi32_mask(a, b);
+}
+SIMD_INLINE vi_t vi_select(vm_t m, vi_t a, vi_t b) {
+    return _mm512_mask_blend_epi32(m, b, a);
+}
+
+// masked off lanes are not loaded at all
+SIMD_INLINE vi_t vi_gather(const uint32_t *base, vi_t idx, vm_t m) {
+    return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, idx, base,
+                                       4);
+}
+
+// byte swap every lane, 0xAABBGGRR -> 0xRRGGBBAA
+SIMD_INLINE vi_t vi_bswap(vi_t a) {
+    return _mm512_shuffle_epi8(
+        a, _mm512_broadcast_i32x4(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10,
+                                                9, 8, 15, 14, 13, 12)));
+}
+
+// every byte times a 8.8 fixed point factor, unpack and pack both work per
+// 128 bit quarter so the lane order comes back unchanged
+SIMD_INLINE vi_t vi_scale_bytes(vi_t a, vi_t factor) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo = _mm512_mullo_epi16(_mm512_unpacklo_epi8(a, zero), factor);
+    __m512i hi = _mm512_mullo_epi16(_mm512_unpackhi_epi8(a, zero), factor);
+    return _mm512_packus_epi16(_mm512_srli_epi16(lo, 8),
+                               _mm512_srli_epi16(hi, 8));
+}
+
+SIMD_INLINE vm_t vm_and(vm_t a, vm_t b) { return a & b; }
+SIMD_INLINE bool vm_any(vm_t m) { return m != 0; }
+SIMD_INLINE unsigned int vm_count(vm_t m) { return __builtin_popcount(m); }
+
+#include "rasterizer_simd.h"
+
+#endif // x86
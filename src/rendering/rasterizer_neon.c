@@ -0,0 +1,97 @@
+#include "rasterizer.h"
+
+#ifdef __ARM_NEON__
+
+#include <arm_neon.h>
+
+// 4 pixels per step, NEON is always there on arm64 so no target attribute
+#define SIMD_WIDTH 4
+#define SIMD_SUFFIX neon
+#define SIMD_TARGET
+#define SIMD_INLINE static inline __attribute__((always_inline))
+
+typedef float32x4_t vf_t;
+typedef int32x4_t vi_t;
+typedef uint32x4_t vm_t;
+
+SIMD_INLINE vf_t vf_set1(float f) { return vdupq_n_f32(f); }
+SIMD_INLINE vf_t vf_lanes(void) {
+    const float lanes[4] = {0, 1, 2, 3};
+    return vld1q_f32(lanes);
+}
+SIMD_INLINE vf_t vf_load(const float *p) { return vld1q_f32(p); }
+SIMD_INLINE void vf_store(float *p, vf_t a) { vst1q_f32(p, a); }
+SIMD_INLINE vf_t vf_add(vf_t a, vf_t b) { return vaddq_f32(a, b); }
+SIMD_INLINE vf_t vf_sub(vf_t a, vf_t b) { return vsubq_f32(a, b); }
+SIMD_INLINE vf_t vf_mul(vf_t a, vf_t b) { return vmulq_f32(a, b); }
+SIMD_INLINE vf_t vf_div(vf_t a, vf_t b) { return vdivq_f32(a, b); }
+// approximate 1 / a, only to about 8 bits, simd_shade sharpens it with a
+// Newton step
+SIMD_INLINE vf_t vf_rcp(vf_t a) { return vrecpeq_f32(a); }
+// a * b + c
+SIMD_INLINE vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return vfmaq_f32(c, a, b); }
+SIMD_INLINE vf_t vf_floor(vf_t a) { return vrndmq_f32(a); }
+SIMD_INLINE vf_t vf_max(vf_t a, vf_t b) { return vmaxq_f32(a, b); }
+SIMD_INLINE float vf_hmax(vf_t a) { return vmaxvq_f32(a); }
+SIMD_INLINE vi_t vf_to_vi(vf_t a) { return vcvtq_s32_f32(a); }
+SIMD_INLINE vm_t vf_cmpge(vf_t a, vf_t b) { return vcgeq_f32(a, b); }
+SIMD_INLINE vm_t vf_cmplt(vf_t a, vf_t b) { return vcltq_f32(a, b); }
+SIMD_INLINE vf_t vf_select(vm_t m, vf_t a, vf_t b) { return vbslq_f32(m, a, b); }
+
+SIMD_INLINE vi_t vi_set1(uint32_t i) { return vdupq_n_s32((int32_t)i); }
+SIMD_INLINE vi_t vi_set1_16(uint16_t i) {
+    return vreinterpretq_s32_u16(vdupq_n_u16(i));
+}
+SIMD_INLINE vi_t vi_load(const uint32_t *p) {
+    return vreinterpretq_s32_u32(vld1q_u32(p));
+}
+SIMD_INLINE void vi_store(uint32_t *p, vi_t a) {
+    vst1q_u32(p, vreinterpretq_u32_s32(a));
+}
+SIMD_INLINE vi_t vi_add(vi_t a, vi_t b) { return vaddq_s32(a, b); }
+SIMD_INLINE vi_t vi_sub(vi_t a, vi_t b) { return vsubq_s32(a, b); }
+SIMD_INLINE vi_t vi_mullo(vi_t a, vi_t b) { return vmulq_s32(a, b); }
+SIMD_INLINE vi_t vi_and(vi_t a, vi_t b) { return vandq_s32(a, b); }
+// shifts zeros in, as a shift left by -n so n needs no immediate
+SIMD_INLINE vi_t vi_srli(vi_t a, int n) {
+    return vreinterpretq_s32_u32(
+        vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(-n)));
+}
+SIMD_INLINE vi_t vi_min(vi_t a, vi_t b) { return vminq_s32(a, b); }
+SIMD_INLINE vi_t vi_max(vi_t a, vi_t b) { return vmaxq_s32(a, b); }
+SIMD_INLINE vm_t vi_cmpgt(vi_t a, vi_t b) { return vcgtq_s32(a, b); }
+SIMD_INLINE vi_t vi_select(vm_t m, vi_t a, vi_t b) { return vbslq_s32(m, a, b); }
+
+// no gather instruction, masked off lanes read texel 0
+SIMD_INLINE vi_t vi_gather(const uint32_t *base, vi_t idx, vm_t m) {
+    int32_t lane[4];
+    vst1q_s32(lane, vandq_s32(idx, vreinterpretq_s32_u32(m)));
+    uint32_t texel[4] = {base[lane[0]], base[lane[1]], base[lane[2]],
+                         base[lane[3]]};
+    return vreinterpretq_s32_u32(vld1q_u32(texel));
+}
+
+// byte swap every lane, 0xAABBGGRR -> 0xRRGGBBAA
+SIMD_INLINE vi_t vi_bswap(vi_t a) {
+    return vreinterpretq_s32_u8(vrev32q_u8(vreinterpretq_u8_s32(a)));
+}
+
+// every byte times a 8.8 fixed point factor
+SIMD_INLINE vi_t vi_scale_bytes(vi_t a, vi_t factor) {
+    uint8x16_t bytes = vreinterpretq_u8_s32(a);
+    uint16x8_t factor16 = vreinterpretq_u16_s32(factor);
+    uint16x8_t lo = vmulq_u16(vmovl_u8(vget_low_u8(bytes)), factor16);
+    uint16x8_t hi = vmulq_u16(vmovl_high_u8(bytes), factor16);
+    return vreinterpretq_s32_u8(
+        vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+}
+
+SIMD_INLINE vm_t vm_and(vm_t a, vm_t b) { return vandq_u32(a, b); }
+SIMD_INLINE bool vm_any(vm_t m) { return vmaxvq_u32(m) != 0; }
+SIMD_INLINE unsigned int vm_count(vm_t m) {
+    return vaddvq_u32(vshrq_n_u32(m, 31));
+}
+
+#include "rasterizer_simd.h"
+
+#endif // arm neon
@@ -0,0 +1,659 @@
+// Body of the vectorized kernels shared by every SIMD backend.
+//
+// This file is not compiled on its own: a backend (rasterizer_sse41.c,
+// rasterizer_avx2.c, rasterizer_avx512.c, rasterizer_neon.c) defines
+// SIMD_WIDTH, SIMD_SUFFIX, SIMD_TARGET, SIMD_INLINE and the vf_ (float lanes),
+// vi_ (int lanes) and vm_ (lane mask) wrappers over its intrinsics, and then
+// includes it. Every kernel gets the backend suffix, fill_triangle becomes
+// fill_triangle_avx2 and so on, and cpu_dispatch.c binds the best one.
+
+#include <math.h>
+
+#define SIMD_CAT_(name, suffix) name##_##suffix
+#define SIMD_CAT(name, suffix) SIMD_CAT_(name, suffix)
+#define SIMD_FN(name) SIMD_CAT(name, SIMD_SUFFIX)
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+} simd_fixed_t;
+
+SIMD_INLINE simd_fixed_t simd_snap(const vec3_t *v) {
+    return (simd_fixed_t){lrintf(v->x * SUBPIXEL_ONE),
+                          lrintf(v->y * SUBPIXEL_ONE)};
+}
+
+// In 1/256ths of a pixel squared, exact since the products fit in 64 bits
+SIMD_INLINE int64_t simd_edge_cross(const simd_fixed_t *A,
+                                    const simd_fixed_t *B,
+                                    const simd_fixed_t *C) {
+    return (int64_t)(C->x - A->x) * (B->y - A->y) -
+           (int64_t)(C->y - A->y) * (B->x - A->x);
+}
+
+SIMD_INLINE bool simd_is_top_left(const simd_fixed_t *start,
+                                  const simd_fixed_t *end) {
+    int32_t edge_x = end->x - start->x;
+    int32_t edge_y = end->y - start->y;
+    return (edge_y == 0 && edge_x > 0) || edge_y > 0;
+}
+
+// Integer edge function over the vectors of a rect, biased so a pixel is
+// covered while it is >= 0. An edge that keeps one sign over the whole rect
+// is folded into a constant, the ones crossing it change by at most the
+// steps over the rect, which for a tile fits in 32 bits
+typedef struct {
+    int32_t row;
+    int32_t col_step;
+    int32_t row_step;
+} simd_edge_t;
+
+// Returns false when no pixel of the rect is on the inner side of the edge
+SIMD_INLINE bool simd_edge_setup(simd_edge_t *edge, const simd_fixed_t *A,
+                                 const simd_fixed_t *B, int x_min, int y_min,
+                                 int columns, int rows) {
+    simd_fixed_t P = {x_min * SUBPIXEL_ONE, y_min * SUBPIXEL_ONE};
+    int64_t start = simd_edge_cross(A, B, &P) - !simd_is_top_left(A, B);
+    int64_t col_step = (int64_t)(B->y - A->y) * SUBPIXEL_ONE;
+    int64_t row_step = (int64_t)(A->x - B->x) * SUBPIXEL_ONE;
+
+    int64_t col_span = col_step * (columns - 1);
+    int64_t row_span = row_step * (rows - 1);
+    int64_t min = start + (col_span < 0 ? col_span : 0) +
+                  (row_span < 0 ? row_span : 0);
+    int64_t max = start + (col_span > 0 ? col_span : 0) +
+                  (row_span > 0 ? row_span : 0);
+    if (max < 0) return false;
+    if (min >= 0) {
+        *edge = (simd_edge_t){0, 0, 0};
+        return true;
+    }
+
+    *edge = (simd_edge_t){start, col_step, row_step};
+    return true;
+}
+
+// How much of a block an edge function keeps, ordered so the block gets the
+// least of its three edges
+typedef enum {
+    SIMD_COVER_NONE,
+    SIMD_COVER_PARTIAL,
+    SIMD_COVER_FULL,
+} simd_cover_t;
+
+// e is the edge function at the top left pixel of the block, whose last
+// pixel is last_column to the right and last_row down from it
+SIMD_INLINE simd_cover_t simd_edge_cover(const simd_edge_t *edge, int32_t e,
+                                         int last_column, int last_row) {
+    int32_t col_span = edge->col_step * last_column;
+    int32_t row_span = edge->row_step * last_row;
+    int32_t min = e + (col_span < 0 ? col_span : 0) +
+                  (row_span < 0 ? row_span : 0);
+    int32_t max = e + (col_span > 0 ? col_span : 0) +
+                  (row_span > 0 ? row_span : 0);
+    if (max < 0) return SIMD_COVER_NONE;
+    return min >= 0 ? SIMD_COVER_FULL : SIMD_COVER_PARTIAL;
+}
+
+SIMD_INLINE simd_cover_t simd_min_cover(simd_cover_t a, simd_cover_t b) {
+    return a < b ? a : b;
+}
+
+// A block is at least a vector wide
+#define SIMD_BLOCK_WIDTH                                                       \
+    (SIMD_WIDTH > RASTER_BLOCK_SIZE ? SIMD_WIDTH : RASTER_BLOCK_SIZE)
+// The 8x8 blocks of the scalar kernel side by side in one block
+#define SIMD_BLOCK_GROUPS (SIMD_BLOCK_WIDTH / RASTER_BLOCK_SIZE)
+
+// Something that varies linearly over the screen: its value at the corner
+// of the bounding box and its steps per column and per row
+typedef struct {
+    float origin;
+    float col_step;
+    float row_step;
+} simd_plane_t;
+
+// The plane of the attribute that is a, b and c at the vertices, given the
+// planes of the edge functions facing them
+SIMD_INLINE simd_plane_t simd_plane_weigh(const simd_plane_t edges[3],
+                                          float a, float b, float c,
+                                          float inv_area) {
+    return (simd_plane_t){
+        (edges[0].origin * a + edges[1].origin * b + edges[2].origin * c) *
+            inv_area,
+        (edges[0].col_step * a + edges[1].col_step * b +
+         edges[2].col_step * c) *
+            inv_area,
+        (edges[0].row_step * a + edges[1].row_step * b +
+         edges[2].row_step * c) *
+            inv_area,
+    };
+}
+
+// The plane over the vector dx columns and dy rows from the corner
+SIMD_INLINE vf_t simd_plane_at(const simd_plane_t *plane, vf_t lanes, int dx,
+                               int dy) {
+    return vf_fmadd(lanes, vf_set1(plane->col_step),
+                    vf_set1(plane->origin + plane->col_step * dx +
+                            plane->row_step * dy));
+}
+
+// What shading a vector of pixels takes from the triangle, set up once per
+// call
+typedef struct {
+    fill_mode_t mode;
+    vi_t color;
+    vi_t lum;
+    vi_t ffs;
+    vi_t zeros;
+
+    bool has_tex;
+    bool bilinear;
+    vf_t twos;
+    vf_t halves;
+    vf_t fixed_one_f;
+    vi_t fixed_one;
+    vi_t ones;
+    vi_t even_bytes;
+    vi_t odd_bytes;
+    const uint32_t *texels;
+    bool pot;
+    vf_t width_f;
+    vf_t height_f;
+    vf_t inv_width;
+    vf_t inv_height;
+    vi_t tile_row;
+    vi_t tile_size;
+    vi_t tile_mask;
+    vi_t texel_mask;
+    vi_t max_u;
+    vi_t max_v;
+} simd_shading_t;
+
+// Samples level from now on
+SIMD_INLINE void simd_bind_level(simd_shading_t *s,
+                                 const tex_level_t *level) {
+    s->texels = (const uint32_t *)level->data;
+    s->pot = level->pot;
+    s->width_f = vf_set1(level->w);
+    s->height_f = vf_set1(level->h);
+    s->inv_width = vf_set1(1.0f / level->w);
+    s->inv_height = vf_set1(1.0f / level->h);
+    s->tile_row = vi_set1(level->tiles_w * TEX_TILE_SIZE);
+    s->max_u = vi_set1(level->w - 1);
+    s->max_v = vi_set1(level->h - 1);
+}
+
+// Texel column or row of c, wrapped into the size of the level
+SIMD_INLINE vi_t simd_wrap(const simd_shading_t *s, vf_t c, vf_t size,
+                           vf_t inv_size, vi_t max) {
+    // sides that are powers of two wrap with a mask, which also keeps lanes
+    // whose coordinate overflowed an int in the texture
+    if (s->pot) return vi_and(vf_to_vi(vf_floor(c)), max);
+
+    // c mod size, clamped so float rounding can never step outside the
+    // texture
+    c = vf_sub(vf_floor(c), vf_mul(vf_floor(vf_mul(c, inv_size)), size));
+    return vi_min(vi_max(vf_to_vi(c), s->zeros), max);
+}
+
+// The column or row after the wrapped c
+SIMD_INLINE vi_t simd_wrap_next(const simd_shading_t *s, vi_t c, vi_t max) {
+    c = vi_add(c, s->ones);
+    return vi_select(vi_cmpgt(c, max), s->zeros, c);
+}
+
+// Index of texel u, v in the tiles of the level. With 4x4 tiles it sits
+// (v & ~3) * tiles_w * 4 texels in for its row of tiles, (u & ~3) * 4 more
+// for its tile and (v & 3) * 4 + (u & 3) inside the tile
+SIMD_INLINE vi_t simd_texel_index(const simd_shading_t *s, vi_t u, vi_t v) {
+    vi_t tile_v = vi_and(v, s->tile_mask);
+    vi_t tile_u = vi_and(u, s->tile_mask);
+    vi_t texel_v = vi_and(v, s->texel_mask);
+    vi_t texel_u = vi_and(u, s->texel_mask);
+    return vi_add(vi_add(vi_mullo(tile_v, s->tile_row),
+                         vi_mullo(vi_add(tile_u, texel_v), s->tile_size)),
+                  texel_u);
+}
+
+// Texel under u, v, in texels
+SIMD_INLINE vi_t simd_sample_nearest(const simd_shading_t *s, vf_t u, vf_t v,
+                                     vm_t mask) {
+    vi_t u_coord = simd_wrap(s, u, s->width_f, s->inv_width, s->max_u);
+    vi_t v_coord = simd_wrap(s, v, s->height_f, s->inv_height, s->max_v);
+    return vi_gather(s->texels, simd_texel_index(s, u_coord, v_coord), mask);
+}
+
+// The four texels around u, v weighed in 8.8 fixed point, one gather each.
+// The even and odd bytes are weighed apart so every product stays in its
+// own 16 bits, the weights add up to exactly 0x100 so no sum carries over
+SIMD_INLINE vi_t simd_sample_bilinear(const simd_shading_t *s, vf_t u,
+                                      vf_t v, vm_t mask) {
+    u = vf_sub(u, s->halves);
+    v = vf_sub(v, s->halves);
+    vi_t u0 = simd_wrap(s, u, s->width_f, s->inv_width, s->max_u);
+    vi_t v0 = simd_wrap(s, v, s->height_f, s->inv_height, s->max_v);
+    vi_t u1 = simd_wrap_next(s, u0, s->max_u);
+    vi_t v1 = simd_wrap_next(s, v0, s->max_v);
+    vi_t taps[4] = {
+        vi_gather(s->texels, simd_texel_index(s, u0, v0), mask),
+        vi_gather(s->texels, simd_texel_index(s, u1, v0), mask),
+        vi_gather(s->texels, simd_texel_index(s, u0, v1), mask),
+        vi_gather(s->texels, simd_texel_index(s, u1, v1), mask),
+    };
+
+    vi_t fu = vf_to_vi(vf_mul(vf_sub(u, vf_floor(u)), s->fixed_one_f));
+    vi_t fv = vf_to_vi(vf_mul(vf_sub(v, vf_floor(v)), s->fixed_one_f));
+    vi_t w11 = vi_srli(vi_mullo(fu, fv), 8);
+    vi_t weights[4] = {
+        vi_add(vi_sub(vi_sub(s->fixed_one, fu), fv), w11),
+        vi_sub(fu, w11),
+        vi_sub(fv, w11),
+        w11,
+    };
+
+    vi_t even = s->zeros;
+    vi_t odd = s->zeros;
+    for (int i = 0; i < 4; i++) {
+        even = vi_add(even,
+                      vi_mullo(vi_and(taps[i], s->even_bytes), weights[i]));
+        odd = vi_add(odd, vi_mullo(vi_and(vi_srli(taps[i], 8), s->even_bytes),
+                                   weights[i]));
+    }
+    return vi_add(vi_and(vi_srli(even, 8), s->even_bytes),
+                  vi_and(odd, s->odd_bytes));
+}
+
+// Z-test, perspective correct uv fetch, lum modulation and the alpha mask
+// of the pixels in inside, z_vec, u_w_vec, v_w_vec and q_vec are their z,
+// u/w, v/w and 1/w. Returns how many of them passed the z-test
+SIMD_INLINE unsigned int simd_shade(const simd_shading_t *s, uint32_t *fb_ptr,
+                                    float *z_ptr, vm_t inside, vf_t z_vec,
+                                    vf_t u_w_vec, vf_t v_w_vec, vf_t q_vec) {
+    vf_t z_buff_vec = vf_load(z_ptr);
+    vm_t z_test = s->mode == FILL_EQUAL_DEPTH
+                      ? vm_and(vf_cmpge(z_vec, z_buff_vec),
+                               vf_cmpge(z_buff_vec, z_vec))
+                      : vf_cmplt(z_vec, z_buff_vec);
+    vm_t mask = vm_and(inside, z_test);
+    // every lane is covered up already, skip the uv math and the fetches
+    if (!vm_any(mask)) return 0;
+
+    unsigned int passed = vm_count(mask);
+    if (s->mode == FILL_DEPTH) {
+        vf_store(z_ptr, vf_select(mask, z_vec, z_buff_vec));
+        return passed;
+    }
+
+    vi_t pixel_color = s->color;
+    if (s->has_tex) {
+        // one reciprocal sharpened by a Newton step stands in for dividing
+        // both u/w and v/w by 1/w
+        vf_t w_vec = vf_rcp(q_vec);
+        w_vec = vf_mul(w_vec, vf_sub(s->twos, vf_mul(q_vec, w_vec)));
+        vf_t u_vec = vf_mul(vf_mul(u_w_vec, w_vec), s->width_f);
+        vf_t v_vec = vf_mul(vf_mul(v_w_vec, w_vec), s->height_f);
+
+        // texels are stored r, g, b, a in memory and the frame buffer wants
+        // 0xRRGGBBAA
+        vi_t rgba_vec = s->bilinear
+                            ? simd_sample_bilinear(s, u_vec, v_vec, mask)
+                            : simd_sample_nearest(s, u_vec, v_vec, mask);
+        pixel_color = vi_scale_bytes(vi_bswap(rgba_vec), s->lum);
+    }
+
+    vm_t is_opaque = vi_cmpgt(vi_and(pixel_color, s->ffs), s->zeros);
+    mask = vm_and(mask, is_opaque);
+
+    vi_t fb_vec = vi_load(fb_ptr);
+    vi_store(fb_ptr, vi_select(mask, pixel_color, fb_vec));
+    if (s->mode == FILL_SHADE)
+        vf_store(z_ptr, vf_select(mask, z_vec, z_buff_vec));
+    return passed;
+}
+
+// Edge functions over blocks of the bounding box, then simd_shade
+// SIMD_WIDTH pixels per step, only pixels inside clip are touched
+SIMD_TARGET unsigned int SIMD_FN(fill_triangle)(
+    uint32_t *frame_buffer, float *z_buffer, const vec3_t ABC[3],
+    const vec3_t ABC_uv[3], const vec3_t *face_normal,
+    const vec3_t *directional_light, const tex_t *tex, const rect_t *clip,
+    fill_mode_t mode) {
+    bool has_tex = ABC_uv && tex;
+    unsigned int passed = 0;
+
+    // the same triangle can be in flight on several tiles, so the winding is
+    // fixed up on copies
+    vec3_t A = ABC[0];
+    vec3_t B = ABC[1];
+    vec3_t C = ABC[2];
+    vec3_t uv[3] = {0};
+    if (has_tex) {
+        uv[0] = ABC_uv[0];
+        uv[1] = ABC_uv[1];
+        uv[2] = ABC_uv[2];
+    }
+
+    simd_fixed_t A_fixed = simd_snap(&A);
+    simd_fixed_t B_fixed = simd_snap(&B);
+    simd_fixed_t C_fixed = simd_snap(&C);
+
+    int64_t area_fixed = simd_edge_cross(&A_fixed, &B_fixed, &C_fixed);
+    if (area_fixed == 0) return 0;
+    if (area_fixed < 0) {
+        area_fixed = -area_fixed;
+
+        vec3_t B_new = C;
+        C = B;
+        B = B_new;
+
+        simd_fixed_t B_fixed_new = C_fixed;
+        C_fixed = B_fixed;
+        B_fixed = B_fixed_new;
+
+        if (has_tex) {
+            B_new = uv[2];
+            uv[2] = uv[1];
+            uv[1] = B_new;
+        }
+    }
+
+    // the weights are interpolated from the snapped vertices too, so they
+    // match the coverage
+    vec3_t *vertices[3] = {&A, &B, &C};
+    simd_fixed_t *fixed[3] = {&A_fixed, &B_fixed, &C_fixed};
+    for (int i = 0; i < 3; i++) {
+        vertices[i]->x = (float)fixed[i]->x / SUBPIXEL_ONE;
+        vertices[i]->y = (float)fixed[i]->y / SUBPIXEL_ONE;
+    }
+    float area = (float)area_fixed / (SUBPIXEL_ONE * SUBPIXEL_ONE);
+
+    int32_t x_min_fixed = A_fixed.x < B_fixed.x ? A_fixed.x : B_fixed.x;
+    x_min_fixed = C_fixed.x < x_min_fixed ? C_fixed.x : x_min_fixed;
+    int32_t x_max_fixed = A_fixed.x > B_fixed.x ? A_fixed.x : B_fixed.x;
+    x_max_fixed = C_fixed.x > x_max_fixed ? C_fixed.x : x_max_fixed;
+    int32_t y_min_fixed = A_fixed.y < B_fixed.y ? A_fixed.y : B_fixed.y;
+    y_min_fixed = C_fixed.y < y_min_fixed ? C_fixed.y : y_min_fixed;
+    int32_t y_max_fixed = A_fixed.y > B_fixed.y ? A_fixed.y : B_fixed.y;
+    y_max_fixed = C_fixed.y > y_max_fixed ? C_fixed.y : y_max_fixed;
+
+    int x_min = x_min_fixed >> SUBPIXEL_BITS;
+    int x_max = (x_max_fixed + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    int y_min = y_min_fixed >> SUBPIXEL_BITS;
+    int y_max = (y_max_fixed + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+
+    // keep the bounding box inside the clip rect and start it on a lane
+    // aligned column, clip rects are lane aligned too so a vector never
+    // leaves the rect or straddles two rows of the buffers
+    x_min = x_min < clip->x_min ? clip->x_min : x_min;
+    y_min = y_min < clip->y_min ? clip->y_min : y_min;
+    x_max = x_max > clip->x_max ? clip->x_max : x_max;
+    y_max = y_max > clip->y_max ? clip->y_max : y_max;
+    if (x_min > x_max || y_min > y_max) return 0;
+    x_min -= x_min % SIMD_WIDTH;
+
+    // every vector that is stepped through, clip rects are lane aligned so
+    // the last one still ends inside
+    int columns = (x_max - x_min + SIMD_WIDTH) / SIMD_WIDTH * SIMD_WIDTH;
+    int rows = y_max - y_min + 1;
+    simd_edge_t edge_A, edge_B, edge_C;
+    if (!simd_edge_setup(&edge_A, &B_fixed, &C_fixed, x_min, y_min, columns,
+                         rows) ||
+        !simd_edge_setup(&edge_B, &C_fixed, &A_fixed, x_min, y_min, columns,
+                         rows) ||
+        !simd_edge_setup(&edge_C, &A_fixed, &B_fixed, x_min, y_min, columns,
+                         rows))
+        return 0;
+
+    vi_t lanes_i = vf_to_vi(vf_lanes());
+    vi_t eA_col_vec = vi_set1(edge_A.col_step * SIMD_WIDTH);
+    vi_t eB_col_vec = vi_set1(edge_B.col_step * SIMD_WIDTH);
+    vi_t eC_col_vec = vi_set1(edge_C.col_step * SIMD_WIDTH);
+    vi_t eA_step_row_vec = vi_set1(edge_A.row_step);
+    vi_t eB_step_row_vec = vi_set1(edge_B.row_step);
+    vi_t eC_step_row_vec = vi_set1(edge_C.row_step);
+    vi_t minus_ones = vi_set1(-1);
+
+    // the float edge functions only weigh the attributes
+    vec3_t P = {x_min, y_min, 0};
+    float wA_origin = (P.x - B.x) * (C.y - B.y) - (P.y - B.y) * (C.x - B.x);
+    float wB_origin = (P.x - C.x) * (A.y - C.y) - (P.y - C.y) * (A.x - C.x);
+    float wC_origin = (P.x - A.x) * (B.y - A.y) - (P.y - A.y) * (B.x - A.x);
+
+    float delta_wA_col = C.y - B.y;
+    float delta_wB_col = A.y - C.y;
+    float delta_wC_col = B.y - A.y;
+
+    float delta_wA_row = B.x - C.x;
+    float delta_wB_row = C.x - A.x;
+    float delta_wC_row = A.x - B.x;
+
+    float lum = vec3_dot(face_normal, directional_light);
+    lum = lum / 2 + 0.5;
+    uint8_t grey = 0xFF * lum;
+    simd_shading_t shading = {
+        .mode = mode,
+        .color = vi_set1(grey * 0x01010101u),
+        .lum = vi_set1_16(lum * 0x100),
+        .ffs = vi_set1(0xFF),
+        .zeros = vi_set1(0),
+        .tile_size = vi_set1(TEX_TILE_SIZE),
+        .tile_mask = vi_set1(~(TEX_TILE_SIZE - 1)),
+        .texel_mask = vi_set1(TEX_TILE_SIZE - 1),
+
+        .has_tex = has_tex,
+        .bilinear = has_tex && tex->filter == TEX_FILTER_BILINEAR,
+        .twos = vf_set1(2),
+        .halves = vf_set1(0.5f),
+        .fixed_one_f = vf_set1(0x100),
+        .fixed_one = vi_set1(0x100),
+        .ones = vi_set1(1),
+        .even_bytes = vi_set1(0x00FF00FF),
+        .odd_bytes = vi_set1(0xFF00FF00),
+    };
+    const tex_level_t *bound_level = NULL;
+    tex_lod_t lod;
+    if (has_tex) {
+        vec3_t b = {wA_origin / area, wB_origin / area, wC_origin / area};
+        vec3_t b_dx = {delta_wA_col / area, delta_wB_col / area,
+                       delta_wC_col / area};
+        vec3_t b_dy = {delta_wA_row / area, delta_wB_row / area,
+                       delta_wC_row / area};
+        tex_lod_setup(&lod, tex, uv, &b, &b_dx, &b_dy);
+    }
+
+    // z, u/w, v/w and 1/w are planes over the screen too, stepped with one
+    // add per vector
+    simd_plane_t edges[3] = {
+        {wA_origin, delta_wA_col, delta_wA_row},
+        {wB_origin, delta_wB_col, delta_wB_row},
+        {wC_origin, delta_wC_col, delta_wC_row},
+    };
+    float inv_area = 1 / area;
+    simd_plane_t z_plane = simd_plane_weigh(edges, A.z, B.z, C.z, inv_area);
+    simd_plane_t u_w_plane =
+        simd_plane_weigh(edges, uv[0].x, uv[1].x, uv[2].x, inv_area);
+    simd_plane_t v_w_plane =
+        simd_plane_weigh(edges, uv[0].y, uv[1].y, uv[2].y, inv_area);
+    simd_plane_t q_plane =
+        simd_plane_weigh(edges, uv[0].z, uv[1].z, uv[2].z, inv_area);
+
+    vf_t lanes = vf_lanes();
+    vf_t z_col_vec = vf_set1(z_plane.col_step * SIMD_WIDTH);
+    vf_t u_w_col_vec = vf_set1(u_w_plane.col_step * SIMD_WIDTH);
+    vf_t v_w_col_vec = vf_set1(v_w_plane.col_step * SIMD_WIDTH);
+    vf_t q_col_vec = vf_set1(q_plane.col_step * SIMD_WIDTH);
+
+    vf_t z_row_step_vec = vf_set1(z_plane.row_step);
+    vf_t u_w_row_step_vec = vf_set1(u_w_plane.row_step);
+    vf_t v_w_row_step_vec = vf_set1(v_w_plane.row_step);
+    vf_t q_row_step_vec = vf_set1(q_plane.row_step);
+
+    vm_t all_lanes = vi_cmpgt(vi_set1(1), shading.zeros);
+#if SIMD_BLOCK_GROUPS > 1
+    // the lanes of each 8x8 block in a vector
+    vm_t group_lanes[SIMD_BLOCK_GROUPS];
+    for (int g = 0; g < SIMD_BLOCK_GROUPS; g++) {
+        group_lanes[g] =
+            vm_and(vi_cmpgt(lanes_i, vi_set1(g * RASTER_BLOCK_SIZE - 1)),
+                   vi_cmpgt(vi_set1((g + 1) * RASTER_BLOCK_SIZE), lanes_i));
+    }
+#endif
+
+    // walk the bounding box in blocks, skip the ones an edge leaves out
+    // entirely and drop the edge tests in the ones no edge goes through.
+    // Vectors start lane aligned, so the columns of a block are whole
+    // vectors that may run past x_max but stay inside the clip rect
+    for (int block_y = y_min - y_min % RASTER_BLOCK_SIZE; block_y <= y_max;
+         block_y += RASTER_BLOCK_SIZE) {
+        int y0 = block_y > y_min ? block_y : y_min;
+        int y1 = block_y + RASTER_BLOCK_SIZE - 1;
+        y1 = y1 < y_max ? y1 : y_max;
+
+        bool has_been_inside = false;
+        for (int block_x = x_min - x_min % SIMD_BLOCK_WIDTH; block_x <= x_max;
+             block_x += SIMD_BLOCK_WIDTH) {
+            int x0 = block_x > x_min ? block_x : x_min;
+            int x1 = block_x + SIMD_BLOCK_WIDTH - 1;
+            x1 = x1 < x_max ? x1 : x_max;
+            int last_column =
+                (x1 - x0) / SIMD_WIDTH * SIMD_WIDTH + SIMD_WIDTH - 1;
+
+            int dx = x0 - x_min;
+            int dy = y0 - y_min;
+            int32_t eA =
+                edge_A.row + edge_A.col_step * dx + edge_A.row_step * dy;
+            int32_t eB =
+                edge_B.row + edge_B.col_step * dx + edge_B.row_step * dy;
+            int32_t eC =
+                edge_C.row + edge_C.col_step * dx + edge_C.row_step * dy;
+
+            simd_cover_t cover = simd_min_cover(
+                simd_min_cover(
+                    simd_edge_cover(&edge_A, eA, last_column, y1 - y0),
+                    simd_edge_cover(&edge_B, eB, last_column, y1 - y0)),
+                simd_edge_cover(&edge_C, eC, last_column, y1 - y0));
+
+            // the blocks a convex triangle covers in a row of blocks are
+            // next to each other
+            if (cover == SIMD_COVER_NONE) {
+                if (has_been_inside) break;
+                continue;
+            }
+            has_been_inside = true;
+            bool full = cover == SIMD_COVER_FULL;
+
+            // one mip level per 8x8 block of the screen, picked at its
+            // center as the scalar kernel does. When the blocks side by side
+            // in a vector pick different ones, each is shaded on its own
+            // lanes in turn
+            const tex_level_t *levels[SIMD_BLOCK_GROUPS] = {NULL};
+            int groups = 1;
+            if (has_tex && mode != FILL_DEPTH) {
+                for (int g = 0; g < SIMD_BLOCK_GROUPS; g++) {
+                    int gx0 = x0 + g * RASTER_BLOCK_SIZE;
+                    int gx1 = gx0 + RASTER_BLOCK_SIZE - 1;
+                    gx1 = gx1 < x1 ? gx1 : x1;
+                    if (gx0 > x1) break;
+                    levels[g] = tex_lod_level(&lod,
+                                              gx0 - x_min + (gx1 - gx0) / 2.0f,
+                                              dy + (y1 - y0) / 2.0f);
+                    if (levels[g] != levels[0]) groups = g + 1;
+                }
+            }
+
+            for (int g = 0; g < groups; g++) {
+                if (has_tex && mode != FILL_DEPTH && levels[g] != bound_level) {
+                    simd_bind_level(&shading, levels[g]);
+                    bound_level = levels[g];
+                }
+
+                vi_t eA_row_vec = vi_add(
+                    vi_set1(eA), vi_mullo(lanes_i, vi_set1(edge_A.col_step)));
+                vi_t eB_row_vec = vi_add(
+                    vi_set1(eB), vi_mullo(lanes_i, vi_set1(edge_B.col_step)));
+                vi_t eC_row_vec = vi_add(
+                    vi_set1(eC), vi_mullo(lanes_i, vi_set1(edge_C.col_step)));
+
+                vf_t z_row_vec = simd_plane_at(&z_plane, lanes, dx, dy);
+                vf_t u_w_row_vec = simd_plane_at(&u_w_plane, lanes, dx, dy);
+                vf_t v_w_row_vec = simd_plane_at(&v_w_plane, lanes, dx, dy);
+                vf_t q_row_vec = simd_plane_at(&q_plane, lanes, dx, dy);
+
+                for (int y = y0; y <= y1; y++) {
+                    vf_t z_vec = z_row_vec;
+                    vf_t u_w_vec = u_w_row_vec;
+                    vf_t v_w_vec = v_w_row_vec;
+                    vf_t q_vec = q_row_vec;
+                    vi_t eA_vec = eA_row_vec;
+                    vi_t eB_vec = eB_row_vec;
+                    vi_t eC_vec = eC_row_vec;
+
+                    for (int x = x0; x <= x1; x += SIMD_WIDTH) {
+                        vm_t inside_triangle_vec =
+                            full ? all_lanes
+                                 : vm_and(vm_and(vi_cmpgt(eA_vec, minus_ones),
+                                                 vi_cmpgt(eB_vec, minus_ones)),
+                                          vi_cmpgt(eC_vec, minus_ones));
+
+#if SIMD_BLOCK_GROUPS > 1
+                        if (groups > 1) {
+                            inside_triangle_vec =
+                                vm_and(inside_triangle_vec, group_lanes[g]);
+                        }
+#endif
+                        if (vm_any(inside_triangle_vec)) {
+                            passed += simd_shade(
+                                &shading, &frame_buffer[SCREEN_WIDTH * y + x],
+                                &z_buffer[SCREEN_WIDTH * y + x],
+                                inside_triangle_vec, z_vec, u_w_vec, v_w_vec,
+                                q_vec);
+                        }
+
+                        z_vec = vf_add(z_vec, z_col_vec);
+                        u_w_vec = vf_add(u_w_vec, u_w_col_vec);
+                        v_w_vec = vf_add(v_w_vec, v_w_col_vec);
+                        q_vec = vf_add(q_vec, q_col_vec);
+                        eA_vec = vi_add(eA_vec, eA_col_vec);
+                        eB_vec = vi_add(eB_vec, eB_col_vec);
+                        eC_vec = vi_add(eC_vec, eC_col_vec);
+                    }
+                    z_row_vec = vf_add(z_row_vec, z_row_step_vec);
+                    u_w_row_vec = vf_add(u_w_row_vec, u_w_row_step_vec);
+                    v_w_row_vec = vf_add(v_w_row_vec, v_w_row_step_vec);
+                    q_row_vec = vf_add(q_row_vec, q_row_step_vec);
+                    eA_row_vec = vi_add(eA_row_vec, eA_step_row_vec);
+                    eB_row_vec = vi_add(eB_row_vec, eB_step_row_vec);
+                    eC_row_vec = vi_add(eC_row_vec, eC_step_row_vec);
+                }
+            }
+        }
+    }
+    return passed;
+}
+
+// The screen size is a multiple of every SIMD_WIDTH, so there is no tail
+SIMD_TARGET void SIMD_FN(clear_framebuffer)(uint32_t *frame_buffer,
+                                            uint32_t color) {
+    vi_t color_vec = vi_set1(color);
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i += SIMD_WIDTH)
+        vi_store(&frame_buffer[i], color_vec);
+}
+
+SIMD_TARGET void SIMD_FN(clear_zbuffer)(float *z_buffer) {
+    vf_t inf_vec = vf_set1(INFINITY);
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i += SIMD_WIDTH)
+        vf_store(&z_buffer[i], inf_vec);
+}
+
+// Wider vectors would read past the block, AVX-512 uses the AVX2 version
+#if SIMD_WIDTH <= HIZ_BLOCK_SIZE
+SIMD_TARGET float SIMD_FN(block_max_z)(const float *z_buffer) {
+    vf_t max_vec = vf_set1(-INFINITY);
+    for (int y = 0; y < HIZ_BLOCK_SIZE; y++, z_buffer += SCREEN_WIDTH) {
+        for (int x = 0; x < HIZ_BLOCK_SIZE; x += SIMD_WIDTH)
+            max_vec = vf_max(max_vec, vf_load(&z_buffer[x]));
+    }
+    return vf_hmax(max_vec);
+}
+#endif
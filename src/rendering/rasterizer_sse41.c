@@ -0,0 +1,103 @@
+#include "rasterizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// 4 pixels per step
+#define SIMD_WIDTH 4
+#define SIMD_TARGET __attribute__((target("sse4.1")))
+#define SIMD_INLINE static inline __attribute__((always_inline)) SIMD_TARGET
+#define SIMD_SUFFIX sse41
+
+typedef __m128 vf_t;
+typedef __m128i vi_t;
+typedef __m128i vm_t;
+
+SIMD_INLINE vf_t vf_set1(float f) { return _mm_set1_ps(f); }
+SIMD_INLINE vf_t vf_lanes(void) { return _mm_setr_ps(0, 1, 2, 3); }
+SIMD_INLINE vf_t vf_load(const float *p) { return _mm_loadu_ps(p); }
+SIMD_INLINE void vf_store(float *p, vf_t a) { _mm_storeu_ps(p, a); }
+SIMD_INLINE vf_t vf_add(vf_t a, vf_t b) { return _mm_add_ps(a, b); }
+SIMD_INLINE vf_t vf_sub(vf_t a, vf_t b) { return _mm_sub_ps(a, b); }
+SIMD_INLINE vf_t vf_mul(vf_t a, vf_t b) { return _mm_mul_ps(a, b); }
+SIMD_INLINE vf_t vf_div(vf_t a, vf_t b) { return _mm_div_ps(a, b); }
+// approximate 1 / a, to 12 bits or better
+SIMD_INLINE vf_t vf_rcp(vf_t a) { return _mm_rcp_ps(a); }
+// a * b + c
+SIMD_INLINE vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+SIMD_INLINE vf_t vf_floor(vf_t a) { return _mm_floor_ps(a); }
+SIMD_INLINE vf_t vf_max(vf_t a, vf_t b) { return _mm_max_ps(a, b); }
+// max of the 4 lanes
+SIMD_INLINE float vf_hmax(vf_t a) {
+    a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+    return _mm_cvtss_f32(a);
+}
+SIMD_INLINE vi_t vf_to_vi(vf_t a) { return _mm_cvttps_epi32(a); }
+SIMD_INLINE vm_t vf_cmpge(vf_t a, vf_t b) {
+    return _mm_castps_si128(_mm_cmpge_ps(a, b));
+}
+SIMD_INLINE vm_t vf_cmplt(vf_t a, vf_t b) {
+    return _mm_castps_si128(_mm_cmplt_ps(a, b));
+}
+SIMD_INLINE vf_t vf_select(vm_t m, vf_t a, vf_t b) {
+    return _mm_blendv_ps(b, a, _mm_castsi128_ps(m));
+}
+
+SIMD_INLINE vi_t vi_set1(uint32_t i) { return _mm_set1_epi32(i); }
+SIMD_INLINE vi_t vi_set1_16(uint16_t i) { return _mm_set1_epi16(i); }
+SIMD_INLINE vi_t vi_load(const uint32_t *p) {
+    return _mm_loadu_si128((const __m128i *)p);
+}
+SIMD_INLINE void vi_store(uint32_t *p, vi_t a) {
+    _mm_storeu_si128((__m128i *)p, a);
+}
+SIMD_INLINE vi_t vi_add(vi_t a, vi_t b) { return _mm_add_epi32(a, b); }
+SIMD_INLINE vi_t vi_sub(vi_t a, vi_t b) { return _mm_sub_epi32(a, b); }
+SIMD_INLINE vi_t vi_mullo(vi_t a, vi_t b) { return _mm_mullo_epi32(a, b); }
+SIMD_INLINE vi_t vi_and(vi_t a, vi_t b) { return _mm_and_si128(a, b); }
+// shifts zeros in
+SIMD_INLINE vi_t vi_srli(vi_t a, int n) { return _mm_srli_epi32(a, n); }
+SIMD_INLINE vi_t vi_min(vi_t a, vi_t b) { return _mm_min_epi32(a, b); }
+SIMD_INLINE vi_t vi_max(vi_t a, vi_t b) { return _mm_max_epi32(a, b); }
+SIMD_INLINE vm_t vi_cmpgt(vi_t a, vi_t b) { return _mm_cmpgt_epi32(a, b); }
+SIMD_INLINE vi_t vi_select(vm_t m, vi_t a, vi_t b) {
+    return _mm_blendv_epi8(b, a, m);
+}
+
+// no hardware gather before AVX2, masked off lanes read texel 0
+SIMD_INLINE vi_t vi_gather(const uint32_t *base, vi_t idx, vm_t m) {
+    idx = _mm_and_si128(idx, m);
+    return _mm_setr_epi32(
+        base[_mm_extract_epi32(idx, 0)], base[_mm_extract_epi32(idx, 1)],
+        base[_mm_extract_epi32(idx, 2)], base[_mm_extract_epi32(idx, 3)]);
+}
+
+// byte swap every lane, 0xAABBGGRR -> 0xRRGGBBAA
+SIMD_INLINE vi_t vi_bswap(vi_t a) {
+    return _mm_shuffle_epi8(
+        a, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+}
+
+// every byte times a 8.8 fixed point factor
+SIMD_INLINE vi_t vi_scale_bytes(vi_t a, vi_t factor) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), factor);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), factor);
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+SIMD_INLINE vm_t vm_and(vm_t a, vm_t b) { return _mm_and_si128(a, b); }
+SIMD_INLINE bool vm_any(vm_t m) {
+    return _mm_movemask_ps(_mm_castsi128_ps(m)) != 0;
+}
+SIMD_INLINE unsigned int vm_count(vm_t m) {
+    return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+}
+
+#include "rasterizer_simd.h"
+
+#endif // x86
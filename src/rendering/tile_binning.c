@@ -0,0 +1,335 @@
+#include "tile_binning.h"
+#include "../threading/thread_pool.h"
+
+#include <math.h>
+
+// Slack for the float error of the interpolated depth, which can land a hair
+// in front of the nearest vertex
+#define HIZ_EPSILON 1e-5f
+// Re-reading a dirty block costs about as much as filling a few pixels, so
+// smaller triangles only refresh the blocks a big triangle was drawn over
+#define HIZ_REFRESH_PIXELS 32
+// Where little is hidden refreshes mostly find the triangle visible anyway, a
+// tile stops refreshing once fewer than 1 in HIZ_REFRESH_RATIO of them rejected
+// something, after HIZ_REFRESH_TRIES free ones
+#define HIZ_REFRESH_RATIO 4
+#define HIZ_REFRESH_TRIES 8
+
+bool create_tile_bins(tile_bins_t *bins) {
+    bins->length = 1024;
+    bins->span = 0;
+    bins->triangles = malloc(sizeof(binned_triangle_t) * bins->length);
+    if (!bins->triangles) {
+        fprintf(stderr, "Error allocating binned triangles.\n");
+        return false;
+    }
+
+    for (int ty = 0; ty < TILES_Y; ty++) {
+        for (int tx = 0; tx < TILES_X; tx++) {
+            tile_t *tile = &bins->tiles[TILES_X * ty + tx];
+            tile->bins = bins;
+
+            // the last row and column of tiles can be cut by the screen edge
+            int x_max = (tx + 1) * TILE_SIZE - 1;
+            int y_max = (ty + 1) * TILE_SIZE - 1;
+            tile->rect = (rect_t){
+                .x_min = tx * TILE_SIZE,
+                .y_min = ty * TILE_SIZE,
+                .x_max = x_max > SCREEN_WIDTH - 1 ? SCREEN_WIDTH - 1 : x_max,
+                .y_max = y_max > SCREEN_HEIGHT - 1 ? SCREEN_HEIGHT - 1 : y_max,
+            };
+
+            tile->length = 256;
+            tile->span = 0;
+            tile->triangles = malloc(sizeof(unsigned int) * tile->length);
+            if (!tile->triangles) {
+                fprintf(stderr, "Error allocating tile bin.\n");
+                return false;
+            }
+
+            for (int i = 0; i < HIZ_BLOCKS * HIZ_BLOCKS; i++)
+                tile->block_z[i] = INFINITY;
+            tile->dirty_blocks = 0;
+            tile->big_dirty_blocks = 0;
+        }
+    }
+
+    bins->hiz_view = (matrix_t){0};
+    bins->hiz_valid = false;
+    bins->depth_prepass = false;
+
+    return true;
+}
+
+void destroy_tile_bins(tile_bins_t *bins) {
+    for (int i = 0; i < TILE_COUNT; i++) free(bins->tiles[i].triangles);
+    free(bins->triangles);
+}
+
+static bool append_to_tile(tile_t *tile, unsigned int triangle) {
+    if (tile->span == tile->length) {
+        unsigned int *triangles =
+            realloc(tile->triangles, sizeof(unsigned int) * tile->length * 2);
+        if (!triangles) return false;
+        tile->triangles = triangles;
+        tile->length *= 2;
+    }
+    tile->triangles[tile->span++] = triangle;
+    return true;
+}
+
+void bin_triangle(tile_bins_t *bins, const vec3_t ABC[3],
+                  const vec3_t ABC_uv[3], const vec3_t *face_normal,
+                  const tex_t *tex) {
+    int x_min = floorf(fminf(ABC[0].x, fminf(ABC[1].x, ABC[2].x)));
+    int x_max = ceilf(fmaxf(ABC[0].x, fmaxf(ABC[1].x, ABC[2].x)));
+    int y_min = floorf(fminf(ABC[0].y, fminf(ABC[1].y, ABC[2].y)));
+    int y_max = ceilf(fmaxf(ABC[0].y, fmaxf(ABC[1].y, ABC[2].y)));
+
+    x_min = x_min < 0 ? 0 : x_min;
+    y_min = y_min < 0 ? 0 : y_min;
+    x_max = x_max > SCREEN_WIDTH - 1 ? SCREEN_WIDTH - 1 : x_max;
+    y_max = y_max > SCREEN_HEIGHT - 1 ? SCREEN_HEIGHT - 1 : y_max;
+    if (x_min > x_max || y_min > y_max) return;
+
+    if (bins->span == bins->length) {
+        binned_triangle_t *triangles = realloc(
+            bins->triangles, sizeof(binned_triangle_t) * bins->length * 2);
+        if (!triangles) {
+            fprintf(stderr, "Error growing binned triangles.\n");
+            return;
+        }
+        bins->triangles = triangles;
+        bins->length *= 2;
+    }
+
+    unsigned int idx = bins->span++;
+    binned_triangle_t *triangle = &bins->triangles[idx];
+    triangle->ABC[0] = ABC[0];
+    triangle->ABC[1] = ABC[1];
+    triangle->ABC[2] = ABC[2];
+    triangle->tex = ABC_uv ? tex : NULL;
+    if (triangle->tex) {
+        triangle->ABC_uv[0] = ABC_uv[0];
+        triangle->ABC_uv[1] = ABC_uv[1];
+        triangle->ABC_uv[2] = ABC_uv[2];
+    }
+    triangle->face_normal = *face_normal;
+    triangle->rect = (rect_t){x_min, y_min, x_max, y_max};
+    triangle->min_z = fminf(ABC[0].z, fminf(ABC[1].z, ABC[2].z));
+
+    for (int ty = y_min / TILE_SIZE; ty <= y_max / TILE_SIZE; ty++) {
+        for (int tx = x_min / TILE_SIZE; tx <= x_max / TILE_SIZE; tx++) {
+            if (!append_to_tile(&bins->tiles[TILES_X * ty + tx], idx))
+                fprintf(stderr, "Error growing tile bin.\n");
+        }
+    }
+}
+
+// Blocks of the tile overlapped by a rect already clipped to it
+static uint64_t rect_blocks(const tile_t *tile, const rect_t *rect) {
+    int bx_min = (rect->x_min - tile->rect.x_min) / HIZ_BLOCK_SIZE;
+    int bx_max = (rect->x_max - tile->rect.x_min) / HIZ_BLOCK_SIZE;
+    int by_min = (rect->y_min - tile->rect.y_min) / HIZ_BLOCK_SIZE;
+    int by_max = (rect->y_max - tile->rect.y_min) / HIZ_BLOCK_SIZE;
+
+    uint64_t row = ((UINT64_C(2) << (bx_max - bx_min)) - 1) << bx_min;
+    uint64_t blocks = 0;
+    for (int by = by_min; by <= by_max; by++)
+        blocks |= row << (by * HIZ_BLOCKS);
+    return blocks;
+}
+
+// The blocks among blocks whose bound is farther than z, the only ones where
+// something at depth z could still pass the z-test
+static uint64_t blocks_beyond(const tile_t *tile, uint64_t blocks, float z) {
+    uint64_t beyond = 0;
+    while (blocks) {
+        int block = __builtin_ctzll(blocks);
+        blocks &= blocks - 1;
+        if (tile->block_z[block] > z) beyond |= UINT64_C(1) << block;
+    }
+    return beyond;
+}
+
+// Takes the bounds of blocks straight from the z buffer
+static void refresh_blocks(tile_t *tile, const float *z_buffer,
+                           uint64_t blocks) {
+    tile->dirty_blocks &= ~blocks;
+    tile->big_dirty_blocks &= ~blocks;
+
+    while (blocks) {
+        int block = __builtin_ctzll(blocks);
+        blocks &= blocks - 1;
+
+        int x = tile->rect.x_min + block % HIZ_BLOCKS * HIZ_BLOCK_SIZE;
+        int y = tile->rect.y_min + block / HIZ_BLOCKS * HIZ_BLOCK_SIZE;
+        tile->block_z[block] = block_max_z(&z_buffer[SCREEN_WIDTH * y + x]);
+    }
+}
+
+// How the hi-z refreshes of a tile paid off over both passes, the pre-pass
+// rejections count here but not in the tile's totals
+typedef struct {
+    unsigned int refreshes;
+    unsigned int rejections;
+} hiz_budget_t;
+
+// One pass over the triangles of the tile, depth_only is the depth pre-pass
+// which only takes the opaque ones
+static void rasterize_pass(tile_t *tile, bool depth_only,
+                           hiz_budget_t *budget) {
+    tile_bins_t *bins = tile->bins;
+
+    for (unsigned int i = 0; i < tile->span; i++) {
+        const binned_triangle_t *triangle =
+            &bins->triangles[tile->triangles[i]];
+
+        fill_mode_t mode = FILL_SHADE;
+        if (bins->depth_prepass && triangle->opaque)
+            mode = depth_only ? FILL_DEPTH : FILL_EQUAL_DEPTH;
+        else if (depth_only)
+            continue;
+
+        // the part of the bounding box inside the tile
+        rect_t rect = triangle->rect;
+        rect.x_min = rect.x_min < tile->rect.x_min ? tile->rect.x_min
+                                                   : rect.x_min;
+        rect.y_min = rect.y_min < tile->rect.y_min ? tile->rect.y_min
+                                                   : rect.y_min;
+        rect.x_max = rect.x_max > tile->rect.x_max ? tile->rect.x_max
+                                                   : rect.x_max;
+        rect.y_max = rect.y_max > tile->rect.y_max ? tile->rect.y_max
+                                                   : rect.y_max;
+
+        // the z-test only passes nearer pixels, so a triangle whose nearest
+        // point is behind every block it touches draws nothing. The bounds
+        // of dirty blocks are stale but never too near, so they are tried
+        // as they are first. Only when every block still in the way can be
+        // refreshed are they read back, big triangles refresh any dirty
+        // block and small ones only those a big triangle was drawn over.
+        float min_z = triangle->min_z - HIZ_EPSILON;
+        unsigned int pixels =
+            (rect.x_max - rect.x_min + 1) * (rect.y_max - rect.y_min + 1);
+        bool big = pixels >= HIZ_REFRESH_PIXELS;
+        uint64_t blocks = rect_blocks(tile, &rect);
+
+        uint64_t beyond = blocks_beyond(tile, blocks, min_z);
+        uint64_t refreshable =
+            big ? tile->dirty_blocks : tile->big_dirty_blocks;
+        bool worth_it =
+            budget->refreshes <= HIZ_REFRESH_TRIES ||
+            budget->rejections * HIZ_REFRESH_RATIO >= budget->refreshes;
+        if (beyond && !(beyond & ~refreshable) && worth_it) {
+            refresh_blocks(tile, bins->z_buffer, beyond);
+            beyond = blocks_beyond(tile, beyond, min_z);
+            budget->refreshes++;
+        }
+        if (!beyond) {
+            budget->rejections++;
+            // the opaque triangles come round again after the pre-pass
+            if (!depth_only) {
+                tile->hiz_triangles++;
+                tile->hiz_pixels += pixels;
+            }
+            continue;
+        }
+
+        tile->fill_pixels[mode] += fill_triangle(
+            bins->frame_buffer, bins->z_buffer, triangle->ABC,
+            triangle->tex ? triangle->ABC_uv : NULL, &triangle->face_normal,
+            bins->directional_light, triangle->tex, &tile->rect, mode);
+
+        // shading at equal depth leaves the z buffer as it was
+        if (mode == FILL_EQUAL_DEPTH) continue;
+        tile->dirty_blocks |= blocks;
+        if (big) tile->big_dirty_blocks |= blocks;
+    }
+}
+
+static void rasterize_tile(void *arg) {
+    tile_t *tile = arg;
+    hiz_budget_t budget = {0, 0};
+
+    if (tile->bins->depth_prepass) rasterize_pass(tile, true, &budget);
+    rasterize_pass(tile, false, &budget);
+}
+
+void flush_tile_bins(state_t *state) {
+    tile_bins_t *bins = state->tile_bins;
+    thread_pool_t *pool = state->engine->thread_pool;
+
+    bins->frame_buffer = state->buffers.frame_buffer;
+    bins->z_buffer = state->buffers.z_buffer;
+    bins->directional_light = &state->engine->directional_light;
+    bins->depth_prepass = state->flags.depth_prepass;
+    if (bins->depth_prepass) {
+        for (unsigned int i = 0; i < bins->span; i++) {
+            binned_triangle_t *triangle = &bins->triangles[i];
+            triangle->opaque =
+                fill_is_opaque(triangle->tex, &triangle->face_normal,
+                               bins->directional_light);
+        }
+    }
+
+    // the z buffer starts the frame cleared
+    for (int i = 0; i < TILE_COUNT; i++) {
+        tile_t *tile = &bins->tiles[i];
+        for (int j = 0; j < HIZ_BLOCKS * HIZ_BLOCKS; j++)
+            tile->block_z[j] = INFINITY;
+        tile->dirty_blocks = 0;
+        tile->big_dirty_blocks = 0;
+        tile->hiz_triangles = 0;
+        tile->hiz_pixels = 0;
+        for (int j = FILL_SHADE; j <= FILL_EQUAL_DEPTH; j++)
+            tile->fill_pixels[j] = 0;
+    }
+    bins->hiz_view = state->engine->view_transform;
+    bins->hiz_valid = true;
+
+    for (int i = 0; i < TILE_COUNT; i++) {
+        if (bins->tiles[i].span > 0)
+            submit_job(pool, rasterize_tile, &bins->tiles[i]);
+    }
+    wait_thread_pool(pool);
+
+    for (int i = 0; i < TILE_COUNT; i++) {
+        state->culling.hiz_triangles += bins->tiles[i].hiz_triangles;
+        state->culling.hiz_pixels += bins->tiles[i].hiz_pixels;
+
+        const unsigned int *fill_pixels = bins->tiles[i].fill_pixels;
+        state->overdraw.shaded_pixels +=
+            fill_pixels[FILL_SHADE] + fill_pixels[FILL_EQUAL_DEPTH];
+        state->overdraw.prepass_pixels += fill_pixels[FILL_DEPTH];
+        state->overdraw.prepass_shaded += fill_pixels[FILL_EQUAL_DEPTH];
+        bins->tiles[i].span = 0;
+    }
+    bins->span = 0;
+}
+
+bool hiz_occludes(const tile_bins_t *bins, const rect_t *rect, float z) {
+    if (!bins->hiz_valid) return false;
+    z -= HIZ_EPSILON;
+
+    for (int ty = rect->y_min / TILE_SIZE; ty <= rect->y_max / TILE_SIZE;
+         ty++) {
+        for (int tx = rect->x_min / TILE_SIZE; tx <= rect->x_max / TILE_SIZE;
+             tx++) {
+            const tile_t *tile = &bins->tiles[TILES_X * ty + tx];
+            rect_t tile_rect = {
+                .x_min = rect->x_min > tile->rect.x_min ? rect->x_min
+                                                        : tile->rect.x_min,
+                .y_min = rect->y_min > tile->rect.y_min ? rect->y_min
+                                                        : tile->rect.y_min,
+                .x_max = rect->x_max < tile->rect.x_max ? rect->x_max
+                                                        : tile->rect.x_max,
+                .y_max = rect->y_max < tile->rect.y_max ? rect->y_max
+                                                        : tile->rect.y_max,
+            };
+            if (blocks_beyond(tile, rect_blocks(tile, &tile_rect), z))
+                return false;
+        }
+    }
+
+    return true;
+}
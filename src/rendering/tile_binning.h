@@ -0,0 +1,99 @@
+#ifndef TILE_BINNING_H
+#define TILE_BINNING_H
+
+#include "rasterizer.h"
+
+// Tiles are a multiple of every SIMD_WIDTH so a kernel vector never crosses
+// into the neighbour tile
+#define TILE_SIZE 64
+#define TILES_X ((SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE)
+#define TILES_Y ((SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+#define TILE_COUNT (TILES_X * TILES_Y)
+
+// Every tile keeps the farthest depth of each of its HIZ_BLOCK_SIZE pixel
+// blocks, 64 of them so a set of blocks fits in one uint64_t
+#define HIZ_BLOCKS (TILE_SIZE / HIZ_BLOCK_SIZE)
+
+// A screen space triangle ready for the fill kernels, tex is NULL when the
+// triangle has no uvs
+typedef struct {
+    vec3_t ABC[3];
+    vec3_t ABC_uv[3];
+    vec3_t face_normal;
+    const tex_t *tex;
+
+    // on screen bounding box and nearest depth, for the hi-z test
+    rect_t rect;
+    float min_z;
+
+    // goes through the depth pre-pass, see fill_is_opaque
+    bool opaque;
+} binned_triangle_t;
+
+typedef struct {
+    struct tile_bins_t *bins;
+    rect_t rect;
+
+    // indices into bins->triangles in submission order, so the z-test ties
+    // resolve the same way as drawing serially
+    unsigned int *triangles;
+    unsigned int span;
+    unsigned int length;
+
+    // hierarchical z: an upper bound of the depth in every block, bit
+    // HIZ_BLOCKS * y + x of dirty_blocks is set once a triangle was drawn
+    // over block (x, y) after its bound was taken, big_dirty_blocks only
+    // tracks the big triangles
+    float block_z[HIZ_BLOCKS * HIZ_BLOCKS];
+    uint64_t dirty_blocks;
+    uint64_t big_dirty_blocks;
+
+    // triangles the hi-z test rejected and the pixels of their bounding
+    // boxes inside the tile
+    unsigned int hiz_triangles;
+    unsigned int hiz_pixels;
+
+    // pixels that passed the depth test, per fill mode
+    unsigned int fill_pixels[FILL_EQUAL_DEPTH + 1];
+} tile_t;
+
+// Triangles are collected for the whole frame and then every tile is
+// rasterized on the thread pool. A tile only writes inside its own rect of
+// the frame and z buffers, so the workers need no locks.
+typedef struct tile_bins_t {
+    binned_triangle_t *triangles;
+    unsigned int span;
+    unsigned int length;
+
+    tile_t tiles[TILE_COUNT];
+
+    // set for the duration of a flush
+    uint32_t *frame_buffer;
+    float *z_buffer;
+    const vec3_t *directional_light;
+    // the opaque triangles are filled depth first, then shaded where they
+    // were left at the front
+    bool depth_prepass;
+
+    // the block bounds outlive the flush, hiz_view is the view they were
+    // drawn with
+    matrix_t hiz_view;
+    bool hiz_valid;
+} tile_bins_t;
+
+bool create_tile_bins(tile_bins_t *bins);
+void destroy_tile_bins(tile_bins_t *bins);
+
+void bin_triangle(tile_bins_t *bins,
+                  const vec3_t ABC[3],
+                  const vec3_t ABC_uv[3],
+                  const vec3_t *face_normal,
+                  const tex_t *tex);
+// Rasterizes every binned triangle and empties the bins
+void flush_tile_bins(state_t *state);
+
+// True when the depth left by the last flush is nearer than z over the whole
+// rect, so nothing at z or farther inside it can be visible
+bool hiz_occludes(const tile_bins_t *bins, const rect_t *rect, float z);
+
+#endif // !TILE_BINNING_H
@@ -6,9 +6,14 @@
 #include "state.h"
 
 #include "./math/vec3.h"
+#include "./rendering/tile_binning.h"
 
 #define FONT_SIZE 24
 
+void (*clear_framebuffer)(uint32_t *frame_buffer,
+                          uint32_t color) = clear_framebuffer_scalar;
+void (*clear_zbuffer)(float *z_buffer) = clear_zbuffer_scalar;
+
 bool create_window(state_t *state) {
     state->running = true;
 
@@ -67,6 +72,12 @@ bool create_window(state_t *state) {
         return false;
     }
 
+    state->tile_bins = malloc(sizeof(tile_bins_t));
+    if (!state->tile_bins || !create_tile_bins(state->tile_bins)) {
+        fprintf(stderr, "Error allocating memory for the tile bins.\n");
+        return false;
+    }
+
     // TEXTURES
     // frame buffer texture
     state->textures.frame_buffer_texture = SDL_CreateTexture(
@@ -94,6 +105,7 @@ bool create_window(state_t *state) {
     // FLAGS
     state->flags.render_flag = FRAME_BUFFER;
     state->flags.render_gui = true;
+    state->flags.depth_prepass = false;
 
     return true;
 }
@@ -106,6 +118,9 @@ void destroy_window(state_t *state) {
     SDL_DestroyTexture(state->textures.z_buffer_texture);
     SDL_DestroyTexture(state->textures.frame_buffer_texture);
 
+    destroy_tile_bins(state->tile_bins);
+    free(state->tile_bins);
+
     free(state->buffers.z_buffer);
     free(state->buffers.frame_buffer);
 
@@ -181,6 +196,9 @@ void process_input(state_t *state) {
             case SDLK_u: // change render gui
                 state->flags.render_gui = !state->flags.render_gui;
                 break;
+            case SDLK_y: // change depth pre-pass
+                state->flags.depth_prepass = !state->flags.depth_prepass;
+                break;
             }
             break;
 
@@ -279,7 +297,7 @@ void update(state_t *state) {
     rotate_camera(state->engine, state->time.delta);
 }
 
-void clear_framebuffer(uint32_t *frame_buffer, uint32_t color) {
+void clear_framebuffer_scalar(uint32_t *frame_buffer, uint32_t color) {
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
         for (int x = 0; x < SCREEN_WIDTH; x++) {
             frame_buffer[(SCREEN_WIDTH * y) + x] = color;
@@ -295,7 +313,7 @@ void clear_wireframe_buffer(bool *wireframe_buffer, bool val) {
     }
 }
 
-void clear_zbuffer(float *zbuffer) {
+void clear_zbuffer_scalar(float *zbuffer) {
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
         for (int x = 0; x < SCREEN_WIDTH; x++) {
             zbuffer[(SCREEN_WIDTH * y) + x] = INFINITY;
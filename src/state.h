@@ -33,6 +33,33 @@ typedef struct {
         Uint64 total_time; 
     } time_tracking;
 
+    // meshlet and occlusion culling of the last frame, see math/meshlet.h
+    // and rendering/tile_binning.h
+    struct {
+        // meshlets whose triangles all faced away
+        unsigned int backfacing_meshlets;
+        unsigned int backfacing_triangles;
+
+        // bvh nodes hidden behind the previous frame's depth
+        unsigned int bvh_nodes;
+        unsigned int bvh_triangles;
+
+        // triangles the tile workers skipped, once per tile they touch, and
+        // their bounding box pixels
+        unsigned int hiz_triangles;
+        unsigned int hiz_pixels;
+    } culling;
+
+    // pixels the fill kernels shaded last frame. With the depth pre-pass on
+    // prepass_pixels passed its depth test, as many as the opaque triangles
+    // would have shaded without it, and prepass_shaded is what they shaded
+    // after it
+    struct {
+        unsigned int shaded_pixels;
+        unsigned int prepass_pixels;
+        unsigned int prepass_shaded;
+    } overdraw;
+
     struct {
         Uint64 last_second;
         Uint64 last_frame;
@@ -52,6 +79,9 @@ typedef struct {
         bool *wireframe_buffer;
     } buffers;
 
+    // rendering/tile_binning.h
+    struct tile_bins_t *tile_bins;
+
     struct {
         SDL_Texture *frame_buffer_texture;
         SDL_Texture *z_buffer_texture;
@@ -68,6 +98,8 @@ typedef struct {
         } render_flag;
 
         bool render_gui;
+        // rendering/rasterizer.h, fill_mode_t
+        bool depth_prepass;
     } flags;
 
     engine_t *engine;
@@ -96,8 +128,14 @@ void draw_wireframe_buffer_pixel(bool *wireframe_buffer,
                                  const int y,
                                  const bool b);
 
+// Bound by init_cpu_dispatch, the scalar versions are always available
+extern void (*clear_framebuffer)(uint32_t *frame_buffer, uint32_t color);
+extern void (*clear_zbuffer)(float *z_buffer);
+
+void clear_framebuffer_scalar(uint32_t *frame_buffer, uint32_t color);
+void clear_zbuffer_scalar(float *z_buffer);
+
 // Z-BUFFER
-void clear_zbuffer(float *z_buffer);
 bool pixel_priority(const float *z_buffer,
                     const int x,
                     const int y,
@@ -0,0 +1,141 @@
+#define _POSIX_C_SOURCE 200809L
+// macOS hides _SC_NPROCESSORS_ONLN under strict POSIX
+#define _DARWIN_C_SOURCE
+
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Pops the next job, the lock must be held and the queue not empty
+static job_t pop_job(thread_pool_t *pool) {
+    job_t job = pool->jobs[pool->head++];
+    if (pool->head == pool->span) {
+        pool->head = 0;
+        pool->span = 0;
+    }
+    return job;
+}
+
+static void finish_job(thread_pool_t *pool) {
+    pool->pending--;
+    if (pool->pending == 0) pthread_cond_broadcast(&pool->all_done);
+}
+
+static void *worker(void *arg) {
+    thread_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->head == pool->span && !pool->stopping)
+            pthread_cond_wait(&pool->job_available, &pool->lock);
+        if (pool->stopping) break;
+
+        job_t job = pop_job(pool);
+        pthread_mutex_unlock(&pool->lock);
+        job.fn(job.arg);
+        pthread_mutex_lock(&pool->lock);
+        finish_job(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static int default_thread_count(void) {
+    const char *requested = getenv("ENGINE_THREADS");
+    if (requested) return atoi(requested) - 1;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? cores - 1 : 0;
+}
+
+bool create_thread_pool(thread_pool_t *pool, int thread_count) {
+    if (thread_count < 0) thread_count = default_thread_count();
+    if (thread_count < 0) thread_count = 0;
+    if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+
+    pool->thread_count = 0;
+    pool->length = 64;
+    pool->head = 0;
+    pool->span = 0;
+    pool->pending = 0;
+    pool->stopping = false;
+
+    pool->jobs = malloc(sizeof(job_t) * pool->length);
+    if (!pool->jobs) {
+        fprintf(stderr, "Error allocating thread pool job queue.\n");
+        return false;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+            fprintf(stderr, "Error creating worker thread %i.\n", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    return true;
+}
+
+void destroy_thread_pool(thread_pool_t *pool) {
+    wait_thread_pool(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->job_available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->jobs);
+}
+
+void submit_job(thread_pool_t *pool, job_fn fn, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->span == pool->length) {
+        job_t *jobs = realloc(pool->jobs, sizeof(job_t) * pool->length * 2);
+        if (!jobs) {
+            // run it here rather than dropping it
+            pthread_mutex_unlock(&pool->lock);
+            fn(arg);
+            return;
+        }
+        pool->jobs = jobs;
+        pool->length *= 2;
+    }
+
+    pool->jobs[pool->span++] = (job_t){fn, arg};
+    pool->pending++;
+    pthread_cond_signal(&pool->job_available);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void wait_thread_pool(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        if (pool->head < pool->span) {
+            // help out instead of sleeping
+            job_t job = pop_job(pool);
+            pthread_mutex_unlock(&pool->lock);
+            job.fn(job.arg);
+            pthread_mutex_lock(&pool->lock);
+            finish_job(pool);
+        } else {
+            pthread_cond_wait(&pool->all_done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define MAX_THREADS 64
+
+typedef void (*job_fn)(void *arg);
+
+typedef struct {
+    job_fn fn;
+    void *arg;
+} job_t;
+
+// Fixed set of workers pulling jobs from one queue. The thread that calls
+// wait_thread_pool runs queued jobs too, so a pool with thread_count workers
+// keeps thread_count + 1 cores busy.
+typedef struct {
+    pthread_t threads[MAX_THREADS];
+    int thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_available;
+    pthread_cond_t all_done;
+
+    job_t *jobs;
+    unsigned int head;
+    unsigned int span;
+    unsigned int length;
+    // jobs queued or still running
+    unsigned int pending;
+
+    bool stopping;
+} thread_pool_t;
+
+// thread_count < 0 picks one worker per online core minus the caller, the
+// ENGINE_THREADS environment variable overrides it
+bool create_thread_pool(thread_pool_t *pool, int thread_count);
+void destroy_thread_pool(thread_pool_t *pool);
+
+void submit_job(thread_pool_t *pool, job_fn fn, void *arg);
+// Blocks until every submitted job has finished
+void wait_thread_pool(thread_pool_t *pool);
+
+#endif // !THREAD_POOL_H